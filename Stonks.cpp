@@ -1,455 +1,6362 @@
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <deque>
+#include <unordered_map>
 #include <iomanip>
 #include <random>
 #include <stdexcept>
 #include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <limits>
+#include <ctime>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <cstdint>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstring>
+#include <cstdlib>
+#include <new>
+#include <charconv>
+#include <system_error>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <csignal>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
 
 using namespace std;
 
-// Linked List for Price History
-struct PriceNode {
-    double price;
-    PriceNode* next;
+// Allocation Counter (debug)
+// Build with -DSTONKS_COUNT_ALLOCATIONS to route global new/delete through a
+// counter, so hot paths can be checked for zero allocations per operation.
+// The tick path is held to zero (see 'allocs'); trades are not (Portfolio).
+#ifdef STONKS_COUNT_ALLOCATIONS
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"  // malloc/free behind new/delete is intended
+#endif
+static atomic<long long> globalAllocations{0};
 
-    PriceNode(double p) : price(p), next(nullptr) {}
-};
+void* operator new(size_t size) {
+    globalAllocations.fetch_add(1, memory_order_relaxed);
+    if (void* memory = malloc(size ? size : 1)) return memory;
+    throw bad_alloc();
+}
+void operator delete(void* memory) noexcept { free(memory); }
+void operator delete(void* memory, size_t) noexcept { free(memory); }
+#endif
 
-// Stock Class
-class Stock {
+// Allocations so far, or -1 when the counter is compiled out
+inline long long allocationCount() {
+#ifdef STONKS_COUNT_ALLOCATIONS
+    return globalAllocations.load(memory_order_relaxed);
+#else
+    return -1;
+#endif
+}
+
+// Monotonic Arena
+// Carves long-lived buffers out of large chunks and releases them all at once,
+// so a subsystem that sets up many buffers (e.g. every stock's price history)
+// makes a handful of allocations instead of one per buffer.
+class Arena {
 private:
-    string symbol;
-    double currentPrice;
-    int availableShares;
-    PriceNode* priceHistoryHead;
+    vector<unique_ptr<char[]>> chunks;
+    size_t chunkSize;
+    size_t used;       // bytes used in the last chunk
+    size_t reserved;
 
 public:
-    Stock() : symbol(""), currentPrice(0.0), availableShares(0), priceHistoryHead(nullptr) {}
+    explicit Arena(size_t chunk = 16 << 20) : chunkSize(chunk), used(chunk), reserved(0) {}
 
-    Stock(string sym, double price, int shares) :
-        symbol(sym), currentPrice(price), availableShares(shares), priceHistoryHead(new PriceNode(price)) {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
 
-    ~Stock() {
-        PriceNode* current = priceHistoryHead;
-        while (current != nullptr) {
-            PriceNode* next = current->next;
-            delete current;
-            current = next;
+    void* allocate(size_t bytes, size_t alignment = alignof(max_align_t)) {
+        if (bytes > chunkSize) {
+            // Oversized requests get a chunk of their own; the current chunk stays last
+            unique_ptr<char[]> large(new char[bytes]);
+            char* memory = large.get();
+            chunks.insert(chunks.empty() ? chunks.end() : chunks.end() - 1, move(large));
+            reserved += bytes;
+            return memory;
         }
+        size_t offset = (used + alignment - 1) & ~(alignment - 1);
+        if (chunks.empty() || offset + bytes > chunkSize) {
+            chunks.emplace_back(new char[chunkSize]);
+            reserved += chunkSize;
+            offset = 0;
+        }
+        used = offset + bytes;
+        return chunks.back().get() + offset;
     }
 
-    string getSymbol() const { return symbol; }
-    double getCurrentPrice() const { return currentPrice; }
-    int getAvailableShares() const { return availableShares; }
+    template <typename T>
+    T* allocateArray(size_t n) {
+        return static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+    }
 
-    void updatePrice() {
-    // Generate a random price change between -2.0 and 2.0
-    srand(time(0));  // Only call srand once in main, but for now in the function
-    double change = (rand() % 401 - 200) / 100.0;  // Change between -2.00 and +2.00
+    // Invalidates everything handed out so far
+    void reset() {
+        chunks.clear();
+        used = chunkSize;
+        reserved = 0;
+    }
 
-    // Debugging: Print the random change to verify it's being generated correctly
-    cout << "Generated change: " << change << endl;
+    size_t bytesReserved() const { return reserved; }
+};
 
-    // Update the current price ensuring it doesn't fall below 0.01
-    currentPrice = max(0.01, currentPrice + change);
+// Logging and Latency Metrics
+// Debug output is compiled in only when STONKS_LOG_LEVEL >= 2, so hot paths
+// pay nothing for it by default. Latencies are recorded per thread into
+// log-linear (HDR-style) histograms: 32 sub-buckets per power of two, about 3%
+// relative precision from 1 ns to hours. Each thread writes only its own
+// buckets (relaxed atomics, no read-modify-write); readers merge all threads'
+// buckets on demand, so stats never pause the market.
+#ifndef STONKS_LOG_LEVEL
+#define STONKS_LOG_LEVEL 0  // 0 = quiet, 1 = info, 2 = debug
+#endif
+#define STONKS_DEBUG(message) \
+    do { if (STONKS_LOG_LEVEL >= 2) { cout << message << endl; } } while (0)
 
-    // Debugging print to see if the price is changing
-    cout << "Updated price: " << fixed << setprecision(2) << currentPrice << endl;
+enum class Metric { Tick, Buy, Sell, TopN, History, Request, Count };
 
-    // Create a new node with the updated price
-    PriceNode* newNode = new PriceNode(currentPrice);
+class LatencyMetrics {
+public:
+    static constexpr int SUB_BITS = 5;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BITS;
+    static constexpr int BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+    static constexpr int METRICS = (int)Metric::Count;
 
-    // Insert the new node at the head of the list
-    newNode->next = priceHistoryHead;
-    priceHistoryHead = newNode; // Now the head points to the new node
-}
+    struct Summary {
+        uint64_t count;
+        double p50, p99, p999, max;  // nanoseconds
+    };
 
+private:
+    struct ThreadBuckets {
+        atomic<uint64_t> counts[METRICS][BUCKETS];
+        atomic<uint64_t> maxima[METRICS];
 
-    void buyShares(int shares) {
-        if (shares <= availableShares) {
-            availableShares -= shares;
-        } else {
-            throw runtime_error("Not enough shares available");
+        ThreadBuckets() {
+            for (auto& metric : counts) for (auto& bucket : metric) bucket.store(0, memory_order_relaxed);
+            for (auto& maximum : maxima) maximum.store(0, memory_order_relaxed);
+        }
+    };
+
+    mutable mutex registryLock;
+    vector<unique_ptr<ThreadBuckets>> threads;  // kept after a thread exits so its samples still count
+    chrono::steady_clock::time_point since;
+
+    ThreadBuckets& local() {
+        thread_local ThreadBuckets* buckets = nullptr;
+        if (!buckets) {
+            lock_guard<mutex> guard(registryLock);
+            threads.emplace_back(new ThreadBuckets());
+            buckets = threads.back().get();
         }
+        return *buckets;
     }
 
-    void sellShares(int shares) {
-        availableShares += shares;
-    }
-
- void displayPriceHistory() const {
-    cout << "Price history for " << symbol << ":\n";
-    PriceNode* current = priceHistoryHead;
-    
-    // Check if the list is empty
-    if (current == nullptr) {
-        cout << "No price history available.\n";
-        return;
-    }
-
-    // Display the prices
-    int count = 0; // Counter to help with detecting cycles
-    while (current != nullptr) {
-        cout << fixed << setprecision(2) << current->price << " ";
-        current = current->next;
-        
-        // For debugging, print the node count
-        count++;
-        if (count > 10) { // Arbitrary limit to detect infinite loop
-            cout << "\nInfinite loop detected! Breaking.";
-            break;
+    static int bucketOf(uint64_t value) {
+        if (value < (uint64_t)SUB_BUCKETS) return (int)value;
+        int exponent = 63 - __builtin_clzll(value);
+        int sub = (int)((value >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1));
+        return (exponent - SUB_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    // Midpoint of the values that land in a bucket
+    static double bucketValue(int bucket) {
+        if (bucket < SUB_BUCKETS) return bucket;
+        int exponent = bucket / SUB_BUCKETS + SUB_BITS - 1;
+        uint64_t sub = bucket % SUB_BUCKETS;
+        uint64_t low = (SUB_BUCKETS + sub) << (exponent - SUB_BITS);
+        return low + ((uint64_t)1 << (exponent - SUB_BITS)) / 2.0;
+    }
+
+public:
+    LatencyMetrics() : since(chrono::steady_clock::now()) {}
+
+    // Allocates the calling thread's buckets now rather than on its first sample
+    void registerThread() { local(); }
+
+    void record(Metric metric, uint64_t nanoseconds) {
+        ThreadBuckets& buckets = local();
+        atomic<uint64_t>& bucket = buckets.counts[(int)metric][bucketOf(nanoseconds)];
+        bucket.store(bucket.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        atomic<uint64_t>& maximum = buckets.maxima[(int)metric];
+        if (nanoseconds > maximum.load(memory_order_relaxed)) maximum.store(nanoseconds, memory_order_relaxed);
+    }
+
+    // Merges every thread's buckets for one metric
+    Summary summarize(Metric metric) const {
+        vector<uint64_t> merged(BUCKETS, 0);
+        Summary summary{0, 0, 0, 0, 0};
+        lock_guard<mutex> guard(registryLock);
+        for (const auto& buckets : threads) {
+            for (int b = 0; b < BUCKETS; ++b) {
+                merged[b] += buckets->counts[(int)metric][b].load(memory_order_relaxed);
+            }
+            summary.max = max(summary.max, (double)buckets->maxima[(int)metric].load(memory_order_relaxed));
+        }
+        for (uint64_t count : merged) summary.count += count;
+
+        const double quantiles[] = {0.50, 0.99, 0.999};
+        double* targets[] = {&summary.p50, &summary.p99, &summary.p999};
+        for (int q = 0; q < 3; ++q) {
+            uint64_t rank = (uint64_t)ceil(quantiles[q] * summary.count);
+            uint64_t seen = 0;
+            for (int b = 0; b < BUCKETS && summary.count > 0; ++b) {
+                seen += merged[b];
+                if (seen >= rank) {
+                    *targets[q] = min(bucketValue(b), summary.max);
+                    break;
+                }
+            }
         }
+        return summary;
+    }
+
+    double secondsSinceReset() const {
+        return chrono::duration<double>(chrono::steady_clock::now() - since).count();
+    }
+
+    // Racy against concurrent recording by design: a sample in flight may survive the reset
+    void reset() {
+        lock_guard<mutex> guard(registryLock);
+        for (const auto& buckets : threads) {
+            for (auto& metric : buckets->counts) for (auto& bucket : metric) bucket.store(0, memory_order_relaxed);
+            for (auto& maximum : buckets->maxima) maximum.store(0, memory_order_relaxed);
+        }
+        since = chrono::steady_clock::now();
+    }
+
+    static const char* name(Metric metric) {
+        static const char* names[] = {"tick", "buy", "sell", "top-n", "history", "request"};
+        return names[(int)metric];
     }
-    cout << endl;
-}
 };
 
-// Binary Search Tree for Portfolio Holdings
-struct TreeNode {
-    string symbol;
-    int shares;
-    TreeNode* left;
-    TreeNode* right;
+inline LatencyMetrics& latencyMetrics() {
+    static LatencyMetrics metrics;
+    return metrics;
+}
+
+// Records the lifetime of a scope under a metric
+class ScopedLatency {
+private:
+    Metric metric;
+    chrono::steady_clock::time_point start;
 
-    TreeNode(string sym, int sh) : symbol(sym), shares(sh), left(nullptr), right(nullptr) {}
+public:
+    explicit ScopedLatency(Metric m) : metric(m), start(chrono::steady_clock::now()) {}
+    ~ScopedLatency() {
+        auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+        latencyMetrics().record(metric, (uint64_t)elapsed.count());
+    }
 };
 
-class Portfolio {
+// Symbol Table
+// Tickers are interned once into dense integer IDs; every subsystem keys on
+// SymbolId and names are looked up only when printing or parsing input.
+typedef uint32_t SymbolId;
+const SymbolId INVALID_SYMBOL = 0xffffffffU;
+
+class SymbolTable {
 private:
-    TreeNode* root;
-    double cash;
-    vector<string> transactionHistory;
-
-    void insert(TreeNode*& node, const string& symbol, int shares) {
-        if (node == nullptr) {
-            node = new TreeNode(symbol, shares);
-        } else if (symbol < node->symbol) {
-            insert(node->left, symbol, shares);
-        } else if (symbol > node->symbol) {
-            insert(node->right, symbol, shares);
-        } else {
-            node->shares += shares; // Update shares if symbol already exists
-        }
+    vector<string> names;
+    unordered_map<string, SymbolId> ids;
+
+public:
+    SymbolId intern(const string& symbol) {
+        auto it = ids.find(symbol);
+        if (it != ids.end()) return it->second;
+        SymbolId id = (SymbolId)names.size();
+        names.push_back(symbol);
+        ids.emplace(symbol, id);
+        return id;
     }
 
-    void display(TreeNode* node) const {
-        if (node != nullptr) {
-            display(node->left);
-            cout << node->symbol << ": " << node->shares << " shares\n";
-            display(node->right);
-        }
+    // INVALID_SYMBOL when the ticker was never interned
+    SymbolId find(const string& symbol) const {
+        auto it = ids.find(symbol);
+        return it != ids.end() ? it->second : INVALID_SYMBOL;
     }
-    TreeNode* findMin(TreeNode* node) {
-    while (node->left != nullptr) {
-        node = node->left;
+
+    const string& name(SymbolId id) const {
+        static const string unknown;
+        return id < names.size() ? names[id] : unknown;
     }
-    return node;
+
+    size_t size() const { return names.size(); }
+    const vector<string>& allNames() const { return names; }
+};
+
+inline SymbolTable& symbolTable() {
+    static SymbolTable table;
+    return table;
 }
 
-    TreeNode* deleteNode(TreeNode* node, const string& symbol) {
-    if (node == nullptr) {
-        return node;
-    }
-    
-    // Traverse the tree to find the node to delete
-    if (symbol < node->symbol) {
-        node->left = deleteNode(node->left, symbol);
-    } else if (symbol > node->symbol) {
-        node->right = deleteNode(node->right, symbol);
-    } else {
-        // Node found, handle deletion
-        if (node->left == nullptr) {
-            TreeNode* temp = node->right;
-            delete node;
-            return temp;
-        } else if (node->right == nullptr) {
-            TreeNode* temp = node->left;
-            delete node;
-            return temp;
-        } else {
-            // Node with two children: Find the inorder successor
-            TreeNode* successor = findMin(node->right);
-            node->symbol = successor->symbol;
-            node->shares = successor->shares;
-            node->right = deleteNode(node->right, successor->symbol);
+// Orders IDs alphabetically for display
+inline void sortByName(vector<SymbolId>& ids) {
+    const SymbolTable& table = symbolTable();
+    sort(ids.begin(), ids.end(), [&](SymbolId a, SymbolId b) { return table.name(a) < table.name(b); });
+}
+
+// Read-Only Mapped File
+// Maps a whole file for zero-copy parsing; platforms without mmap read it
+// into a buffer instead.
+class MappedFile {
+private:
+    const char* bytes;
+    size_t length;
+    vector<char> fallback;
+
+public:
+    explicit MappedFile(const string& path) : bytes(nullptr), length(0) {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd == -1) throw runtime_error("Cannot open " + path);
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                bytes = (const char*)mapped;
+                length = (size_t)info.st_size;
+#ifdef MADV_SEQUENTIAL
+                madvise(mapped, length, MADV_SEQUENTIAL);
+#endif
+            }
         }
+        ::close(fd);
+        if (!bytes) throw runtime_error("Cannot map " + path);
+#else
+        ifstream file(path, ios::binary);
+        if (!file) throw runtime_error("Cannot open " + path);
+        fallback.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        bytes = fallback.data();
+        length = fallback.size();
+#endif
     }
-    return node;
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (bytes) munmap((void*)bytes, length);
+#endif
     }
 
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+// Snapshot Serialization
+// Flat little-endian encoding used by save/restore on each subsystem. Symbol
+// IDs are written raw; the reader maps them onto this process's SymbolTable
+// through the names stored at the front of the snapshot.
+class SnapshotWriter {
+private:
+    vector<char> buffer;
+
 public:
-    Portfolio(double initialCash = 10000.0) : root(nullptr), cash(initialCash) {}
-    void buyStock(Stock& stock, int shares) {
-        double cost = shares * stock.getCurrentPrice();
-        if (cost <= cash) {
-            stock.buyShares(shares);
-            insert(root, stock.getSymbol(), shares);
-            cash -= cost;
+    template <typename T>
+    void put(const T& value) {
+        const char* bytes = (const char*)&value;
+        buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+    }
 
-            // Record transaction
-            string transaction = "Bought " + to_string(shares) + " shares of " +
-                stock.getSymbol() + " at $" + to_string(stock.getCurrentPrice());
-            transactionHistory.push_back(transaction);
-        } else {
-            throw runtime_error("Insufficient funds");
+    template <typename T>
+    void putArray(const T* data, size_t n) {
+        put<uint64_t>(n);
+        const char* bytes = (const char*)data;
+        buffer.insert(buffer.end(), bytes, bytes + n * sizeof(T));
+    }
+
+    void putString(const string& text) {
+        put<uint32_t>((uint32_t)text.size());
+        buffer.insert(buffer.end(), text.begin(), text.end());
+    }
+
+    void putSymbolTable() {
+        const SymbolTable& table = symbolTable();
+        put<uint64_t>(table.size());
+        for (SymbolId id = 0; id < table.size(); ++id) {
+            putString(table.name(id));
         }
     }
-    void updateShares(TreeNode*& node, const string& symbol, int deltaShares) {
-    if (node == nullptr) return;
 
-    if (symbol < node->symbol) {
-        updateShares(node->left, symbol, deltaShares);
-    } else if (symbol > node->symbol) {
-        updateShares(node->right, symbol, deltaShares);
-    } else {
-        node->shares += deltaShares;
-        if (node->shares <= 0) {
-            deleteNode(root, symbol); // Remove node if no shares are left
+    vector<char>& data() { return buffer; }
+};
+
+class SnapshotReader {
+private:
+    const char* cursor;
+    const char* end;
+    vector<SymbolId> symbolMap;  // snapshot ID -> this process's ID
+
+    void need(size_t bytes) const {
+        if ((size_t)(end - cursor) < bytes) {
+            throw runtime_error("Snapshot is truncated");
         }
     }
-}
 
+public:
+    SnapshotReader(const char* data, size_t size) : cursor(data), end(data + size) {}
 
-    void sellStock(Stock& stock, int shares) {
-    if (holdings(stock.getSymbol()) >= shares) {
-        stock.sellShares(shares);
-        updateShares(root, stock.getSymbol(), -shares); // Update the number of shares
-        cash += shares * stock.getCurrentPrice();
+    template <typename T>
+    T get() {
+        need(sizeof(T));
+        T value;
+        memcpy(&value, cursor, sizeof(T));
+        cursor += sizeof(T);
+        return value;
+    }
 
-        // Record transaction
-        string transaction = "Sold " + to_string(shares) + " shares of " +
-            stock.getSymbol() + " at $" + to_string(stock.getCurrentPrice());
-        transactionHistory.push_back(transaction);
-    } else {
-        throw runtime_error("Not enough shares in portfolio");
+    // Reads an element count, rejecting one the remaining bytes cannot hold
+    // at `elementBytes` or more apiece (so a corrupt count never reaches reserve)
+    uint64_t getCount(size_t elementBytes) {
+        uint64_t n = get<uint64_t>();
+        if (n > (uint64_t)(end - cursor) / elementBytes) {
+            throw runtime_error("Snapshot is truncated");
+        }
+        return n;
     }
-}
 
+    template <typename T>
+    void getArray(vector<T>& out) {
+        uint64_t n = getCount(sizeof(T));
+        out.resize(n);
+        if (n > 0) memcpy(out.data(), cursor, n * sizeof(T));
+        cursor += n * sizeof(T);
+    }
 
-    int holdings(const string& symbol) const {
-        TreeNode* current = root;
-        while (current != nullptr) {
-            if (symbol < current->symbol) {
-                current = current->left;
-            } else if (symbol > current->symbol) {
-                current = current->right;
-            } else {
-                return current->shares;
-            }
+    string getString() {
+        uint32_t length = get<uint32_t>();
+        need(length);
+        string text(cursor, length);
+        cursor += length;
+        return text;
+    }
+
+    void readSymbolTable() {
+        uint64_t n = getCount(sizeof(uint32_t));
+        symbolMap.clear();
+        symbolMap.reserve(n);
+        for (uint64_t i = 0; i < n; ++i) {
+            symbolMap.push_back(symbolTable().intern(getString()));
         }
-        return 0; // Symbol not found
     }
 
-    void displayPortfolioSummary() const {
-        cout << "\n=== Portfolio Summary ===\n";
-        cout << "Cash: $" << fixed << setprecision(2) << cash << "\n\n";
-        cout << "Holdings:\n";
-        display(root);
+    SymbolId getSymbol() {
+        return mapSymbol(get<uint32_t>());
     }
 
-    void displayTransactionHistory() const {
-        cout << "\n=== Transaction History ===\n";
-        for (const auto& transaction : transactionHistory) {
-            cout << transaction << "\n";
+    SymbolId mapSymbol(uint32_t raw) const {
+        if (raw == INVALID_SYMBOL) return INVALID_SYMBOL;
+        if (raw >= symbolMap.size()) {
+            throw runtime_error("Snapshot refers to an unknown symbol");
         }
+        return symbolMap[raw];
     }
 };
 
-// Max-Heap for Top N Stocks
-class MaxHeap {
+// Compressed Price Tier
+// Holds evicted prices in RAM as bit-packed blocks of BLOCK_SIZE prices.
+// Lossless mode is Gorilla XOR coding: an unchanged price costs 1 bit, any
+// other stores only the XOR bits that differ from the previous double.
+// Cents mode rounds to whole cents and stores the cent delta in 1 to 68
+// bits (11 for a move under $2.56). Each block opens with a raw value, so a
+// Cursor reaches any index by decoding at most one block prefix.
+class CompressedPrices {
+public:
+    enum class Mode { Lossless, Cents };
+    static constexpr size_t BLOCK_SIZE = 1024;
+
 private:
-    vector<pair<string, double>> heap;
+    // Coder state shared by append and Cursor
+    struct State {
+        uint64_t position = 0;  // bit offset (decoding only)
+        uint64_t previous = 0;  // previous double's bits, or previous cents
+        int leading = -1;       // XOR window of the last explicit header (lossless)
+        int trailing = 0;
+    };
 
-    void heapifyUp(int index) {
-        while (index > 0) {
-            int parent = (index - 1) / 2;
-            if (heap[index].second > heap[parent].second) {
-                swap(heap[index], heap[parent]);
-                index = parent;
-            } else {
-                break;
-            }
+    Mode mode;
+    vector<uint64_t> words;
+    uint64_t bitCount;
+    vector<uint64_t> blockStarts;  // bit offset of each block's raw value
+    size_t count;
+    State encoder;
+
+    void writeBits(uint64_t value, int bits) {
+        if (bits == 0) return;
+        size_t word = bitCount >> 6;
+        int offset = (int)(bitCount & 63);
+        if (word + 1 >= words.capacity()) {
+            words.reserve(words.capacity() + words.capacity() / 8 + 16);  // modest slack: memory is the point
         }
+        if (word == words.size()) words.push_back(0);
+        words[word] |= value << offset;
+        if (offset + bits > 64) words.push_back(value >> (64 - offset));
+        bitCount += bits;
     }
 
-    void heapifyDown(int index) {
-        int size = heap.size();
-        while (index < size) {
-            int left = 2 * index + 1;
-            int right = 2 * index + 2;
-            int largest = index;
+    uint64_t readBits(State& state, int bits) const {
+        if (bits == 0) return 0;
+        size_t word = state.position >> 6;
+        int offset = (int)(state.position & 63);
+        uint64_t value = words[word] >> offset;
+        if (offset + bits > 64) value |= words[word + 1] << (64 - offset);
+        state.position += bits;
+        return bits == 64 ? value : value & ((1ULL << bits) - 1);
+    }
 
-            if (left < size && heap[left].second > heap[largest].second) {
-                largest = left;
-            }
-            if (right < size && heap[right].second > heap[largest].second) {
-                largest = right;
-            }
-            if (largest != index) {
-                swap(heap[index], heap[largest]);
-                index = largest;
-            } else {
-                break;
-            }
-        }
+    static uint64_t toBits(double price) {
+        uint64_t bits;
+        memcpy(&bits, &price, sizeof(bits));
+        return bits;
     }
 
-public:
-    void insert(const string& symbol, double price) {
-        heap.emplace_back(symbol, price);
-        heapifyUp(heap.size() - 1);
+    static double fromBits(uint64_t bits) {
+        double price;
+        memcpy(&price, &bits, sizeof(price));
+        return price;
     }
 
-    void removeMax() {
-        if (heap.empty()) return;
-        heap[0] = heap.back();
-        heap.pop_back();
-        heapifyDown(0);
+    void encodeXor(uint64_t value) {
+        uint64_t diff = value ^ encoder.previous;
+        encoder.previous = value;
+        if (diff == 0) {
+            writeBits(0, 1);
+            return;
+        }
+        int leading = min(__builtin_clzll(diff), 31);
+        int trailing = __builtin_ctzll(diff);
+        if (encoder.leading != -1 && leading >= encoder.leading && trailing >= encoder.trailing) {
+            writeBits(0b01, 2);  // '1','0': reuse the previous window
+            writeBits(diff >> encoder.trailing, 64 - encoder.leading - encoder.trailing);
+            return;
+        }
+        int meaningful = 64 - leading - trailing;
+        writeBits(0b11, 2);
+        writeBits((uint64_t)leading, 5);
+        writeBits((uint64_t)(meaningful - 1), 6);
+        writeBits(diff >> trailing, meaningful);
+        encoder.leading = leading;
+        encoder.trailing = trailing;
     }
 
-    void displayTopN(int N) const {
-        cout << "\n=== Top " << N << " Stocks ===\n";
-        for (int i = 0; i < min(N, (int)heap.size()); ++i) {
-            cout << heap[i].first << ": $" << fixed << setprecision(2) << heap[i].second << "\n";
+    void encodeCents(int64_t cents) {
+        int64_t delta = cents - (int64_t)encoder.previous;
+        encoder.previous = (uint64_t)cents;
+        uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+        if (zigzag == 0) {
+            writeBits(0, 1);
+        } else if (zigzag < (1ULL << 9)) {
+            writeBits(0b01, 2);
+            writeBits(zigzag, 9);
+        } else if (zigzag < (1ULL << 16)) {
+            writeBits(0b011, 3);
+            writeBits(zigzag, 16);
+        } else if (zigzag < (1ULL << 32)) {
+            writeBits(0b0111, 4);
+            writeBits(zigzag, 32);
+        } else {
+            writeBits(0b1111, 4);
+            writeBits(zigzag, 64);
         }
     }
-};
 
-// Graph for Market Relationships
-class Graph {
-private:
-    map<string, vector<string>> adjacencyList;
+    // Decodes the value at `index`, which must be the next one after `state`
+    double decode(State& state, size_t index) const {
+        if (index % BLOCK_SIZE == 0) {
+            state.position = blockStarts[index / BLOCK_SIZE];
+            state.previous = readBits(state, 64);
+            state.leading = -1;
+        } else if (mode == Mode::Lossless) {
+            if (readBits(state, 1) != 0) {
+                if (readBits(state, 1) != 0) {
+                    state.leading = (int)readBits(state, 5);
+                    state.trailing = 64 - state.leading - (int)readBits(state, 6) - 1;
+                }
+                state.previous ^= readBits(state, 64 - state.leading - state.trailing) << state.trailing;
+            }
+        } else {
+            uint64_t zigzag = 0;
+            if (readBits(state, 1) != 0) {
+                int bits = 64;
+                if (readBits(state, 1) == 0) bits = 9;
+                else if (readBits(state, 1) == 0) bits = 16;
+                else if (readBits(state, 1) == 0) bits = 32;
+                zigzag = readBits(state, bits);
+            }
+            int64_t delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+            state.previous = (uint64_t)((int64_t)state.previous + delta);
+        }
+        return mode == Mode::Lossless ? fromBits(state.previous) : (int64_t)state.previous / 100.0;
+    }
 
 public:
-    void addEdge(const string& stock1, const string& stock2) {
-        adjacencyList[stock1].push_back(stock2);
-        adjacencyList[stock2].push_back(stock1); // Assuming undirected graph
+    explicit CompressedPrices(Mode m = Mode::Lossless) : mode(m), bitCount(0), count(0) {}
+
+    void append(double price) {
+        if (count % BLOCK_SIZE == 0) {
+            blockStarts.push_back(bitCount);
+            encoder = State();
+            encoder.previous = mode == Mode::Lossless ? toBits(price) : (uint64_t)llround(price * 100.0);
+            writeBits(encoder.previous, 64);
+        } else if (mode == Mode::Lossless) {
+            encodeXor(toBits(price));
+        } else {
+            encodeCents(llround(price * 100.0));
+        }
+        count++;
     }
 
-    void displayRelationships() const {
-        cout << "\n=== Stock Relationships ===\n";
-        for (const auto& pair : adjacencyList) {
-            cout << pair.first << " is related to: ";
-            for (const auto& relatedStock : pair.second) {
-                cout << relatedStock << " ";
+    Mode getMode() const { return mode; }
+    size_t size() const { return count; }
+    size_t bytes() const { return (words.capacity() + blockStarts.capacity()) * sizeof(uint64_t); }
+
+    // Streams prices oldest first from index `first`
+    class Cursor {
+    private:
+        const CompressedPrices& source;
+        State state;
+        size_t index;
+
+    public:
+        Cursor(const CompressedPrices& prices, size_t first) : source(prices), index(first - first % BLOCK_SIZE) {
+            while (index < first && index < source.count) next();
+        }
+
+        bool done() const { return index >= source.count; }
+
+        double next() {
+            if (done()) throw out_of_range("Compressed price cursor past the end");
+            return source.decode(state, index++);
+        }
+    };
+
+    // Round-trip check: encodes `count` generated prices (repeats, small moves,
+    // jumps and sub-cent noise), then decodes them from the start and from a
+    // mid-block index. Returns the first index that comes back wrong (lossless
+    // must be bit-exact, cents within half a cent), or -1 if all match.
+    static long long roundTripCheck(Mode mode, size_t count, uint64_t seed) {
+        mt19937_64 random(seed);
+        uniform_real_distribution<double> unit(0.0, 1.0);
+        vector<double> prices(count);
+        double price = 100.0;
+        for (size_t i = 0; i < count; ++i) {
+            double r = unit(random);
+            if (r < 0.3) {
+                // unchanged
+            } else if (r < 0.9) {
+                price = max(0.01, price + (unit(random) - 0.5) * 0.2);
+            } else if (r < 0.97) {
+                price = min(1e6, max(0.01, price * (0.5 + 1.5 * unit(random))));
+            } else {
+                price += 1e-9;
+            }
+            prices[i] = price;
+        }
+
+        CompressedPrices encoded(mode);
+        for (double value : prices) encoded.append(value);
+        auto matches = [&](size_t i, double decoded) {
+            if (mode == Mode::Lossless) return toBits(decoded) == toBits(prices[i]);
+            return fabs(decoded - prices[i]) <= 0.005 + 1e-9;
+        };
+        Cursor all(encoded, 0);
+        for (size_t i = 0; i < count; ++i) {
+            if (!matches(i, all.next())) return (long long)i;
+        }
+        size_t middle = count / 2 + 7;
+        if (middle < count) {
+            Cursor part(encoded, middle);
+            for (size_t i = middle; i < min(count, middle + BLOCK_SIZE); ++i) {
+                if (!matches(i, part.next())) return (long long)i;
             }
-            cout << endl;
         }
+        return all.done() ? -1 : (long long)count;
     }
 };
 
-// StockMarket Class
-class StockMarket {
+// Ring Buffer for Price History
+// Keeps the most recent `capacity` prices in contiguous storage. Older prices
+// are dropped, or moved to a spill tier when one is set: a file of raw
+// doubles, or CompressedPrices blocks in memory. A spill file is not held
+// open: evictions collect in a SPILL_BATCH buffer that is appended to the
+// file (open, write, close) when full, so many symbols never exhaust the
+// process's file descriptors.
+// Running totals keep SMA O(1) for any N. Monotonic queues keep min/max O(1)
+// only over the configured window (setWindow rebuilds them in O(window)).
+class PriceHistory {
 private:
-    map<string, Stock> stocks;
-    MaxHeap topStocks;
-    Graph stockGraph;
+    // Fixed-size deque of (tick, price) that keeps the window extreme at the front
+    struct MonotonicQueue {
+        vector<pair<long long, double>> slots;
+        size_t front = 0;
+        size_t size = 0;
 
-public:
-    StockMarket() {
-        stocks.emplace("AAPL", Stock("AAPL", 150.0, 1000));
-        stocks.emplace("GOOG", Stock("GOOG", 2500.0, 500));
-        stocks.emplace("MSFT", Stock("MSFT", 200.0, 2000));
-        stocks.emplace("AMZN", Stock("AMZN", 3000.0, 1500));
-        stocks.emplace("TSLA", Stock("TSLA", 700.0, 800));
+        void reset(size_t window) {
+            slots.assign(window + 1, make_pair(0LL, 0.0));
+            front = 0;
+            size = 0;
+        }
+
+        // keepMax: true for a max queue, false for a min queue
+        void push(long long tick, double price, bool keepMax) {
+            while (size > 0) {
+                double back = slots[(front + size - 1) % slots.size()].second;
+                if (keepMax ? back > price : back < price) break;
+                size--;
+            }
+            slots[(front + size) % slots.size()] = make_pair(tick, price);
+            size++;
+        }
+
+        void expire(long long oldestTick) {
+            while (size > 0 && slots[front].first < oldestTick) {
+                front = (front + 1) % slots.size();
+                size--;
+            }
+        }
+
+        double top() const { return size > 0 ? slots[front].second : 0.0; }
+    };
+
+    unique_ptr<double[]> ownedStorage;
+    double* prices;              // ring slots, grown lazily up to capacity
+    double* cumulative;          // running total of every price up to each slot
+    size_t allocated;            // slots backed by storage; equals capacity once the ring wraps
+    size_t capacity;
+    size_t head;                 // slot of the oldest retained price
+    size_t count;
+    long long ticks;
+    double total;
+    double evictedTotal;         // running total just before the oldest retained price
+
+    size_t window;
+    int emaPeriod;
+    double emaValue;
+    MonotonicQueue minQueue;
+    MonotonicQueue maxQueue;
+
+    string spillPath;                 // empty: no spill file
+    unique_ptr<double[]> spillBuffer; // SPILL_BATCH evictions not yet in the file
+    size_t spillBuffered;
+    unique_ptr<CompressedPrices> compressedTier;
+    long long spilled;                // in the file, the buffer or the compressed tier
+
+    size_t slotOf(size_t age) const { return (head + count - 1 - age) % capacity; }
+
+    // Copies the retained prices oldest first into new arrays of `slots` entries each
+    void relocate(double* newPrices, double* newCumulative, size_t slots) {
+        for (size_t age = count; age-- > 0;) {
+            size_t slot = slotOf(age);
+            newPrices[count - 1 - age] = prices[slot];
+            newCumulative[count - 1 - age] = cumulative[slot];
+        }
+        prices = newPrices;
+        cumulative = newCumulative;
+        allocated = slots;
+        head = 0;
     }
 
-    Stock& getStock(const string& symbol) {
-        if (stocks.find(symbol) != stocks.end()) {
-            return stocks[symbol];
-        } else {
-            throw runtime_error("Stock not found");
+    void ownStorage(size_t slots) {
+        unique_ptr<double[]> storage(new double[2 * slots]);
+        relocate(storage.get(), storage.get() + slots, slots);
+        ownedStorage.swap(storage);
+    }
+
+    void spill(double price) {
+        if (compressedTier) {
+            compressedTier->append(price);
+            spilled++;
+        } else if (!spillPath.empty()) {
+            if (!spillBuffer) spillBuffer.reset(new double[SPILL_BATCH]);
+            spillBuffer[spillBuffered++] = price;
+            spilled++;
+            if (spillBuffered == SPILL_BATCH) flushSpill();
         }
     }
 
-    void updateMarket() {
-        for (auto& pair : stocks) {
-            pair.second.updatePrice();
-            topStocks.insert(pair.first, pair.second.getCurrentPrice());
+    // Appends the buffered evictions to the spill file. A failed write drops
+    // the whole file tier, so kept ticks stay contiguous with the ring.
+    void flushSpill() {
+        FILE* file = fopen(spillPath.c_str(), "ab");
+        bool written = file && fwrite(spillBuffer.get(), sizeof(double), spillBuffered, file) == spillBuffered;
+        if (file && fclose(file) != 0) written = false;
+        if (!written) {
+            spillPath.clear();
+            spilled = 0;
         }
+        spillBuffered = 0;
     }
 
-    void displayMarketStatus() const {
-        cout << "\n=== Market Status ===\n";
-        for (const auto& pair : stocks) {
-            cout << pair.first << ": $" << fixed << setprecision(2) << pair.second.getCurrentPrice() << "\n";
+    void rebuildQueues() {
+        minQueue.reset(window);
+        maxQueue.reset(window);
+        size_t n = min(window, count);
+        for (size_t age = n; age-- > 0;) {
+            long long tick = ticks - 1 - (long long)age;
+            minQueue.push(tick, prices[slotOf(age)], false);
+            maxQueue.push(tick, prices[slotOf(age)], true);
         }
     }
 
-    void displayMarketNews() const {
-        cout << "\n=== Market News ===\n";
-        cout << "No news available.\n";
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 4096;
+    static constexpr size_t DEFAULT_WINDOW = 20;
+    static constexpr size_t SPILL_BATCH = 512;
+
+    PriceHistory(size_t cap = DEFAULT_CAPACITY) :
+        prices(nullptr), cumulative(nullptr), allocated(0), capacity(max<size_t>(cap, 1)), head(0), count(0), ticks(0), total(0.0), evictedTotal(0.0),
+        window(min(DEFAULT_WINDOW, capacity)), emaPeriod((int)DEFAULT_WINDOW), emaValue(0.0), spillBuffered(0), spilled(0) {
+        rebuildQueues();
     }
 
-    void searchStock(const string& symbol) const {
-        if (stocks.find(symbol) != stocks.end()) {
-            cout << "Stock found: " << symbol << " - $" << stocks.at(symbol).getCurrentPrice() << "\n";
-        } else {
-            cout << "Stock not found: " << symbol << "\n";
+    void append(double price) {
+        if (count == capacity) {
+            spill(prices[head]);
+            evictedTotal = cumulative[head];
+            head = (head + 1) % capacity;
+            count--;
+        }
+
+        total += price;
+        size_t slot = (head + count) % capacity;
+        if (slot >= allocated) {
+            ownStorage(min(capacity, max<size_t>(16, allocated * 2)));
         }
+        prices[slot] = price;
+        cumulative[slot] = total;
+        count++;
+
+        emaValue = ticks == 0 ? price : emaValue + (price - emaValue) * 2.0 / (emaPeriod + 1);
+        minQueue.push(ticks, price, false);
+        maxQueue.push(ticks, price, true);
+        ticks++;
+        minQueue.expire(ticks - (long long)window);
+        maxQueue.expire(ticks - (long long)window);
     }
 
-    void displayTopStocks(int N) const {
-        topStocks.displayTopN(N);
+    // Shrinks or grows the ring, spilling prices that no longer fit. The
+    // result always lives in the history's own storage.
+    void setCapacity(size_t newCapacity) {
+        newCapacity = max<size_t>(newCapacity, 1);
+        while (count > newCapacity) {
+            spill(prices[head]);
+            evictedTotal = cumulative[head];
+            head = (head + 1) % capacity;
+            count--;
+        }
+        ownStorage(max<size_t>(count, min<size_t>(newCapacity, 16)));
+        capacity = newCapacity;
+        setWindow(window);
     }
 
-    void addStockRelationship(const string& stock1, const string& stock2) {
-        stockGraph.addEdge(stock1, stock2);
+    // Moves the ring into caller-provided storage of 2 * capacity doubles (e.g.
+    // from an Arena) so appends never allocate. The caller keeps it alive.
+    void useStorage(double* storage) {
+        relocate(storage, storage + capacity, capacity);
+        ownedStorage.reset();
     }
 
-    void displayStockRelationships() const {
-        stockGraph.displayRelationships();
+    // Clamped to the capacity; a window of 0 would leave the min/max queues without slots
+    void setWindow(size_t newWindow) {
+        if (newWindow < 1) throw runtime_error("History window must be at least 1");
+        window = min(newWindow, capacity);
+        rebuildQueues();
     }
-};
 
-// PortfolioManager Class
-class PortfolioManager {
-private:
-    map<string, Portfolio> portfolios;
-    string currentPortfolioName;
+    // Takes effect from the next tick; the current EMA is kept as the seed
+    void setEmaPeriod(int period) { emaPeriod = max(period, 1); }
 
-public:
-    void createPortfolio(const string& name, double initialCash = 10000.0) {
-        portfolios.emplace(name, Portfolio(initialCash));
-        cout << "Portfolio '" << name << "' created.\n";
+    // Evicted prices are appended to `path` (truncated now) from now on. The
+    // file is reopened once per SPILL_BATCH evictions, so ticks that spill to
+    // a file are not allocation-free; the compressed tier is.
+    void setSpillFile(const string& path) {
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file) {
+            throw runtime_error("Cannot open spill file " + path);
+        }
+        fclose(file);
+        compressedTier.reset();
+        spillPath = path;
+        spillBuffered = 0;
+        spilled = 0;
     }
 
-    void selectPortfolio(const string& name) {
-        if (portfolios.find(name) != portfolios.end()) {
-            currentPortfolioName = name;
-            cout << "Selected portfolio: " << name << "\n";
-        } else {
-            throw runtime_error("Portfolio not found");
-        }
+    // Evicted prices are compressed in memory from now on, replacing any spill file
+    void setCompressedTier(CompressedPrices::Mode mode) {
+        spillPath.clear();
+        spillBuffered = 0;
+        compressedTier.reset(new CompressedPrices(mode));
+        spilled = 0;
     }
 
-    Portfolio& getCurrentPortfolio() {
-        if (currentPortfolioName.empty()) {
-            throw runtime_error("No portfolio selected");
+    // Reads back up to `n` spilled prices starting at spilled index `first` (oldest = 0)
+    size_t readSpilled(long long first, size_t n, double* out) const {
+        if (first < 0 || first >= spilled) return 0;
+        n = (size_t)min<long long>((long long)n, spilled - first);
+        if (compressedTier) {
+            CompressedPrices::Cursor cursor(*compressedTier, (size_t)first);
+            for (size_t i = 0; i < n; ++i) out[i] = cursor.next();
+            return n;
         }
-        return portfolios[currentPortfolioName];
+        if (spillPath.empty()) return 0;
+
+        // Oldest first: whole batches in the file, then the buffer
+        long long inFile = spilled - (long long)spillBuffered;
+        size_t read = 0;
+        if (first < inFile) {
+            FILE* file = fopen(spillPath.c_str(), "rb");
+            if (!file) return 0;
+            if (fseek(file, (long)(first * (long long)sizeof(double)), SEEK_SET) == 0) {
+                read = fread(out, sizeof(double), (size_t)min<long long>((long long)n, inFile - first), file);
+            }
+            fclose(file);
+            if (first + (long long)read < inFile) return read;
+        }
+        for (; read < n; ++read) {
+            out[read] = spillBuffer[first + (long long)read - inFile];
+        }
+        return read;
     }
 
-    void displayPortfolios() const {
-        cout << "\n=== Available Portfolios ===\n";
-        for (const auto& pair : portfolios) {
-            cout << pair.first << "\n";
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+    size_t getCapacity() const { return capacity; }
+    size_t getWindow() const { return window; }
+    int getEmaPeriod() const { return emaPeriod; }
+    long long totalTicks() const { return ticks; }
+    long long spilledTicks() const { return spilled; }
+    long long keptTicks() const { return spilled + (long long)count; }
+    size_t ringBytes() const { return 2 * allocated * sizeof(double); }
+    size_t compressedBytes() const { return compressedTier ? compressedTier->bytes() : 0; }
+
+    // Visits up to `n` kept prices oldest first from kept index `first` (0 =
+    // oldest spilled price), decoding the spill tier as it goes
+    template <typename Visitor>
+    void scan(long long first, long long n, Visitor visit) const {
+        first = max(first, 0LL);
+        n = min(n, keptTicks() - first);
+        if (n <= 0) return;
+        if (first < spilled) {
+            long long fromTier = min(n, spilled - first);
+            if (compressedTier) {
+                CompressedPrices::Cursor cursor(*compressedTier, (size_t)first);
+                for (long long i = 0; i < fromTier; ++i) visit(cursor.next());
+            } else {
+                double chunk[512];
+                for (long long done = 0; done < fromTier;) {
+                    size_t read = readSpilled(first + done, (size_t)min<long long>(512, fromTier - done), chunk);
+                    if (read == 0) return;
+                    for (size_t i = 0; i < read; ++i) visit(chunk[i]);
+                    done += read;
+                }
+            }
+            first += fromTier;
+            n -= fromTier;
+        }
+        for (size_t age = (size_t)(keptTicks() - 1 - first); n-- > 0; --age) {
+            visit(prices[slotOf(age)]);
         }
     }
 
-    bool hasPortfolios() const {
-        return !portfolios.empty();
+    // age 0 is the latest price
+    double at(size_t age) const {
+        if (age >= count) throw out_of_range("Price history index out of range");
+        return prices[slotOf(age)];
     }
-};
+    double latest() const { return at(0); }
 
-// Main Function
-int main() {
-    StockMarket market;
-    PortfolioManager portfolioManager;
+    double sma(size_t n) const {
+        n = min(n, count);
+        if (n == 0) return 0.0;
+        double before = n == count ? evictedTotal : cumulative[slotOf(n)];
+        return (cumulative[slotOf(0)] - before) / n;
+    }
+
+    double ema() const { return emaValue; }
+    // Over the last getWindow() prices only; another N needs setWindow(N) first
+    double windowMin() const { return minQueue.top(); }
+    double windowMax() const { return maxQueue.top(); }
+
+    // Retained prices are written oldest first; the spill tier is not part of a snapshot
+    void save(SnapshotWriter& out) const {
+        vector<double> orderedPrices, orderedCumulative;
+        orderedPrices.reserve(count);
+        orderedCumulative.reserve(count);
+        for (size_t age = count; age-- > 0;) {
+            orderedPrices.push_back(prices[slotOf(age)]);
+            orderedCumulative.push_back(cumulative[slotOf(age)]);
+        }
+        out.put<uint64_t>(capacity);
+        out.put<uint64_t>(window);
+        out.put<int32_t>(emaPeriod);
+        out.put<double>(emaValue);
+        out.put<int64_t>(ticks);
+        out.put<double>(total);
+        out.put<double>(evictedTotal);
+        out.putArray(orderedPrices.data(), orderedPrices.size());
+        out.putArray(orderedCumulative.data(), orderedCumulative.size());
+    }
+
+    void restore(SnapshotReader& in) {
+        capacity = max<size_t>(in.get<uint64_t>(), 1);
+        window = min(max<size_t>(in.get<uint64_t>(), 1), capacity);
+        emaPeriod = max(in.get<int32_t>(), 1);
+        emaValue = in.get<double>();
+        ticks = in.get<int64_t>();
+        total = in.get<double>();
+        evictedTotal = in.get<double>();
+        vector<double> savedPrices, savedCumulative;
+        in.getArray(savedPrices);
+        in.getArray(savedCumulative);
+        if (savedPrices.size() != savedCumulative.size() || savedPrices.size() > capacity) {
+            throw runtime_error("Snapshot has an inconsistent price history");
+        }
+        count = 0;
+        ownStorage(max<size_t>(savedPrices.size(), min<size_t>(capacity, 16)));
+        copy(savedPrices.begin(), savedPrices.end(), prices);
+        copy(savedCumulative.begin(), savedCumulative.end(), cumulative);
+        count = savedPrices.size();
+        spillPath.clear();
+        spillBuffered = 0;
+        compressedTier.reset();
+        spilled = 0;
+        rebuildQueues();
+    }
+};
+
+// Counter-based RNG for the random walk
+// Every draw is a pure function of (seed, stream, counter), so a tick can be
+// replayed or computed in any order. Uses only 32-bit multiplies so the
+// tick kernels auto-vectorize.
+inline uint32_t mixBits(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+// Per-tick key shared by every stream in that tick
+inline uint32_t tickKey(uint64_t seed, long long tick) {
+    return mixBits((uint32_t)seed ^ mixBits((uint32_t)(seed >> 32) + (uint32_t)tick * 0x9E3779B9U));
+}
+
+// Price change in [-2.00, +2.00] in 0.01 steps, scaled by volatility
+inline double randomStep(uint32_t key, uint32_t stream, double volatility) {
+    uint32_t draw = ((mixBits(key ^ (stream * 0x85ebca6bU)) >> 16) * 401U) >> 16;
+    return ((int)draw - 200) * 0.01 * volatility;
+}
+
+// Limit Order Book
+// Prices are whole cents. Each cent in the covered range has a FIFO queue of
+// resting orders (price-time priority). Order nodes come from a pool with a
+// free list, so add, cancel and match reuse memory once the book has warmed up;
+// the level array only grows when an order lands outside the covered range.
+class OrderBook {
+public:
+    struct Trade {
+        long long buyOrderId;
+        long long sellOrderId;
+        double price;
+        int quantity;
+    };
+
+private:
+    struct OrderNode {
+        long long id;
+        long long tick;
+        int quantity;
+        int prev;
+        int next;
+        bool buy;
+    };
+
+    struct PriceLevel {
+        int head = -1;
+        int tail = -1;
+        long long quantity = 0;
+    };
+
+    static constexpr long long LEVEL_MARGIN = 2048;
+    static constexpr long long MAX_LEVELS = 1LL << 22;  // 64 MB of levels per book
+
+    vector<OrderNode> nodes;
+    vector<int> freeNodes;
+    vector<PriceLevel> levels;
+    long long baseTick;
+    long long bestBidTick;
+    long long bestAskTick;
+    long long bidOrders;
+    long long askOrders;
+    long long nextSequence;
+    vector<Trade> fills;
+
+    static long long toTicks(double price) { return llround(price * 100.0); }
+
+    PriceLevel& levelAt(long long tick) { return levels[(size_t)(tick - baseTick)]; }
+    const PriceLevel& levelAt(long long tick) const { return levels[(size_t)(tick - baseTick)]; }
+    bool inRange(long long tick) const { return tick >= baseTick && tick < baseTick + (long long)levels.size(); }
+
+    void coverTick(long long tick) {
+        if (levels.empty()) {
+            baseTick = max(1LL, tick - LEVEL_MARGIN);
+            levels.resize((size_t)(tick + LEVEL_MARGIN - baseTick));
+            return;
+        }
+        if (inRange(tick)) return;
+
+        long long newBase = min(baseTick, max(1LL, tick - LEVEL_MARGIN));
+        long long newEnd = max(baseTick + (long long)levels.size(), tick + LEVEL_MARGIN);
+        if (newEnd - newBase > MAX_LEVELS) {
+            throw runtime_error("Order price is too far from the resting orders");
+        }
+        vector<PriceLevel> grown((size_t)(newEnd - newBase));
+        copy(levels.begin(), levels.end(), grown.begin() + (baseTick - newBase));
+        levels.swap(grown);
+        baseTick = newBase;
+    }
+
+    int allocateNode() {
+        if (!freeNodes.empty()) {
+            int index = freeNodes.back();
+            freeNodes.pop_back();
+            return index;
+        }
+        nodes.push_back(OrderNode());
+        return (int)nodes.size() - 1;
+    }
+
+    void unlink(int index) {
+        OrderNode& node = nodes[index];
+        PriceLevel& level = levelAt(node.tick);
+        if (node.prev != -1) nodes[node.prev].next = node.next; else level.head = node.next;
+        if (node.next != -1) nodes[node.next].prev = node.prev; else level.tail = node.prev;
+        level.quantity -= node.quantity;
+
+        if (node.buy) bidOrders--; else askOrders--;
+        node.id = 0;
+        node.quantity = 0;
+        freeNodes.push_back(index);
+    }
+
+    // Moves the best bid down / best ask up past empty levels
+    void refreshBest(bool buySide) {
+        if (buySide) {
+            if (bidOrders == 0) return;
+            while (levelAt(bestBidTick).head == -1) bestBidTick--;
+        } else {
+            if (askOrders == 0) return;
+            while (levelAt(bestAskTick).head == -1) bestAskTick++;
+        }
+    }
+
+    void matchLevel(long long tick, int& quantity, long long incomingId, bool incomingBuy) {
+        PriceLevel& level = levelAt(tick);
+        while (quantity > 0 && level.head != -1) {
+            int index = level.head;
+            OrderNode& resting = nodes[index];
+            int fill = min(quantity, resting.quantity);
+
+            Trade trade;
+            trade.buyOrderId = incomingBuy ? incomingId : resting.id;
+            trade.sellOrderId = incomingBuy ? resting.id : incomingId;
+            trade.price = tick / 100.0;
+            trade.quantity = fill;
+            fills.push_back(trade);
+
+            resting.quantity -= fill;
+            level.quantity -= fill;
+            quantity -= fill;
+            if (resting.quantity == 0) {
+                unlink(index);
+            }
+        }
+        refreshBest(!incomingBuy);
+    }
+
+public:
+    OrderBook() : baseTick(0), bestBidTick(0), bestAskTick(0), bidOrders(0), askOrders(0), nextSequence(1) {}
+
+    // Matches against the opposite side, then rests any remainder at `price`.
+    // Returns the order ID; the trades it caused are in getFills().
+    long long addOrder(bool buy, int quantity, double price) {
+        if (quantity <= 0) throw runtime_error("Order quantity must be positive");
+        long long tick = toTicks(price);
+        if (tick <= 0) throw runtime_error("Order price must be positive");
+
+        // The only step that can throw, so it runs before the book changes:
+        // a rejected order leaves no node behind and no fills applied
+        coverTick(tick);
+        fills.clear();
+        int index = allocateNode();
+        long long id = (nextSequence++ << 32) | index;
+
+        if (buy) {
+            while (quantity > 0 && askOrders > 0 && bestAskTick <= tick) {
+                matchLevel(bestAskTick, quantity, id, true);
+            }
+        } else {
+            while (quantity > 0 && bidOrders > 0 && bestBidTick >= tick) {
+                matchLevel(bestBidTick, quantity, id, false);
+            }
+        }
+
+        if (quantity == 0) {
+            freeNodes.push_back(index);
+            return id;
+        }
+
+        OrderNode& node = nodes[index];
+        node.id = id;
+        node.tick = tick;
+        node.quantity = quantity;
+        node.buy = buy;
+        node.next = -1;
+
+        PriceLevel& level = levelAt(tick);
+        node.prev = level.tail;
+        if (level.tail != -1) nodes[level.tail].next = index; else level.head = index;
+        level.tail = index;
+        level.quantity += quantity;
+
+        if (buy) {
+            if (bidOrders++ == 0 || tick > bestBidTick) bestBidTick = tick;
+        } else {
+            if (askOrders++ == 0 || tick < bestAskTick) bestAskTick = tick;
+        }
+        return id;
+    }
+
+    bool cancelOrder(long long id) {
+        long long index = id & 0xffffffffLL;
+        if (index >= (long long)nodes.size() || nodes[(size_t)index].id != id || id == 0) {
+            return false;
+        }
+        bool buy = nodes[(size_t)index].buy;
+        unlink((int)index);
+        refreshBest(buy);
+        return true;
+    }
+
+    const vector<Trade>& getFills() const { return fills; }
+    bool hasBid() const { return bidOrders > 0; }
+    bool hasAsk() const { return askOrders > 0; }
+    double bestBid() const { return bidOrders > 0 ? bestBidTick / 100.0 : 0.0; }
+    double bestAsk() const { return askOrders > 0 ? bestAskTick / 100.0 : 0.0; }
+    long long restingOrders() const { return bidOrders + askOrders; }
+
+    void display(int depth) const {
+        cout << "  Asks:\n";
+        vector<long long> askTicks;
+        for (long long tick = bestAskTick; askOrders > 0 && (int)askTicks.size() < depth && inRange(tick); ++tick) {
+            if (levelAt(tick).head != -1) askTicks.push_back(tick);
+        }
+        for (auto it = askTicks.rbegin(); it != askTicks.rend(); ++it) {
+            cout << "    $" << fixed << setprecision(2) << *it / 100.0 << " x " << levelAt(*it).quantity << "\n";
+        }
+        cout << "  Bids:\n";
+        int shown = 0;
+        for (long long tick = bestBidTick; bidOrders > 0 && shown < depth && inRange(tick); --tick) {
+            if (levelAt(tick).head != -1) {
+                cout << "    $" << fixed << setprecision(2) << tick / 100.0 << " x " << levelAt(tick).quantity << "\n";
+                shown++;
+            }
+        }
+    }
+};
+
+// Stock Class
+// Price, share and volume counters are atomic so client threads can trade
+// while the market ticks; buyShares reserves shares with a compare-and-swap
+// and never oversells. History and the order book belong to the tick thread.
+class Stock {
+private:
+    SymbolId id;
+    atomic<double> currentPrice;
+    double openPrice;
+    atomic<int> availableShares;
+    atomic<long long> volume;
+    PriceHistory history;
+    unique_ptr<OrderBook> orderBook;  // created on the first limit order
+
+public:
+    // Moves happen only while listing, never concurrently with trading
+    Stock(Stock&& other) noexcept :
+        id(other.id), currentPrice(other.currentPrice.load()), openPrice(other.openPrice),
+        availableShares(other.availableShares.load()), volume(other.volume.load()),
+        history(move(other.history)), orderBook(move(other.orderBook)) {}
+
+    Stock& operator=(Stock&& other) noexcept {
+        id = other.id;
+        currentPrice = other.currentPrice.load();
+        openPrice = other.openPrice;
+        availableShares = other.availableShares.load();
+        volume = other.volume.load();
+        history = move(other.history);
+        orderBook = move(other.orderBook);
+        return *this;
+    }
+
+    Stock(const Stock&) = delete;
+    Stock& operator=(const Stock&) = delete;
+
+    Stock() : id(INVALID_SYMBOL), currentPrice(0.0), openPrice(0.0), availableShares(0), volume(0) {}
+
+    Stock(string sym, double price, int shares) :
+        id(symbolTable().intern(sym)), currentPrice(price), openPrice(price), availableShares(shares), volume(0) {
+        history.append(price);
+    }
+
+    SymbolId getId() const { return id; }
+    const string& getSymbol() const { return symbolTable().name(id); }
+    double getCurrentPrice() const { return currentPrice.load(memory_order_relaxed); }
+    int getAvailableShares() const { return availableShares.load(memory_order_relaxed); }
+    double getOpenPrice() const { return openPrice; }
+    long long getVolume() const { return volume.load(memory_order_relaxed); }
+    PriceHistory& getHistory() { return history; }
+    const PriceHistory& getHistory() const { return history; }
+
+    OrderBook& getOrderBook() {
+        if (!orderBook) orderBook.reset(new OrderBook());
+        return *orderBook;
+    }
+
+    // Limit prices must lie within PRICE_BAND of the last price (limit up /
+    // limit down), which bounds the book's level array and how far a single
+    // order can move the price
+    static constexpr double PRICE_BAND = 0.10;
+
+    // Each trade print becomes the new current price
+    long long submitOrder(bool buy, int quantity, double limitPrice) {
+        double last = getCurrentPrice();
+        if (!(limitPrice >= last * (1.0 - PRICE_BAND) && limitPrice <= last * (1.0 + PRICE_BAND))) {
+            ostringstream message;
+            message << "Limit price must be within " << PRICE_BAND * 100 << "% of the last price $" << fixed
+                    << setprecision(2) << last;
+            throw runtime_error(message.str());
+        }
+        long long id = getOrderBook().addOrder(buy, quantity, limitPrice);
+        for (const auto& trade : orderBook->getFills()) {
+            applyPrice(trade.price);
+            volume.fetch_add(trade.quantity, memory_order_relaxed);
+        }
+        return id;
+    }
+
+    bool cancelOrder(long long id) {
+        return orderBook && orderBook->cancelOrder(id);
+    }
+
+    // Resting limit orders are not part of a snapshot
+    void save(SnapshotWriter& out) const {
+        out.put<uint32_t>(id);
+        out.put<double>(currentPrice);
+        out.put<double>(openPrice);
+        out.put<int32_t>(availableShares);
+        out.put<int64_t>(volume);
+        history.save(out);
+    }
+
+    void restore(SnapshotReader& in) {
+        id = in.getSymbol();
+        currentPrice = in.get<double>();
+        openPrice = in.get<double>();
+        availableShares = in.get<int32_t>();
+        volume = in.get<int64_t>();
+        history.restore(in);
+        orderBook.reset();
+    }
+
+    void displayOrderBook(int depth) const {
+        cout << "\n=== Order Book: " << getSymbol() << " ===\n";
+        if (!orderBook || orderBook->restingOrders() == 0) {
+            cout << "No resting orders.\n";
+            return;
+        }
+        orderBook->display(depth);
+    }
+
+    void updatePrice() {
+    // Generate a random price change between -2.0 and 2.0, keyed on this symbol and tick
+    double change = randomStep(tickKey(0, history.totalTicks()), id, 1.0);
+
+    // Debugging: Print the random change to verify it's being generated correctly
+    STONKS_DEBUG("Generated change: " << change);
+
+    // Update the current price ensuring it doesn't fall below 0.01
+    currentPrice = max(0.01, getCurrentPrice() + change);
+
+    // Debugging print to see if the price is changing
+    STONKS_DEBUG("Updated price: " << fixed << setprecision(2) << getCurrentPrice());
+
+    history.append(getCurrentPrice());
+}
+
+    // Records a price computed elsewhere (tick engine, trades)
+    void applyPrice(double price) {
+        currentPrice.store(price, memory_order_relaxed);
+        history.append(price);
+    }
+
+
+    void buyShares(int shares) {
+        if (shares <= 0) throw runtime_error("Share count must be positive");
+        int available = availableShares.load(memory_order_relaxed);
+        do {
+            if (shares > available) {
+                throw runtime_error("Not enough shares available");
+            }
+        } while (!availableShares.compare_exchange_weak(available, available - shares, memory_order_relaxed));
+        volume.fetch_add(shares, memory_order_relaxed);
+    }
+
+    void sellShares(int shares) {
+        if (shares <= 0) throw runtime_error("Share count must be positive");
+        availableShares.fetch_add(shares, memory_order_relaxed);
+        volume.fetch_add(shares, memory_order_relaxed);
+    }
+
+    void displayPriceHistory(int count = 10) const {
+        ScopedLatency latency(Metric::History);
+        cout << "Price history for " << getSymbol() << " (" << history.totalTicks() << " ticks):\n";
+        if (history.empty()) {
+            cout << "No price history available.\n";
+            return;
+        }
+
+        // Most recent first; beyond the ring, older prices come from the spill tier
+        long long shown = min<long long>(max(count, 0), history.keptTicks());
+        vector<double> recent;
+        recent.reserve((size_t)shown);
+        history.scan(history.keptTicks() - shown, shown, [&](double price) { recent.push_back(price); });
+        for (auto it = recent.rbegin(); it != recent.rend(); ++it) {
+            cout << fixed << setprecision(2) << *it << " ";
+        }
+        cout << "\n";
+        cout << "SMA(" << history.getWindow() << "): " << history.sma(history.getWindow())
+             << "  EMA(" << history.getEmaPeriod() << "): " << history.ema()
+             << "  Min: " << history.windowMin() << "  Max: " << history.windowMax() << "\n";
+    }
+
+    // Range statistics over kept ticks [first, first + count), streamed across both tiers
+    void displayHistoryRange(long long first, long long count) const {
+        ScopedLatency latency(Metric::History);
+        long long seen = 0;
+        double low = numeric_limits<double>::max(), high = 0.0, total = 0.0, last = 0.0;
+        auto start = chrono::steady_clock::now();
+        history.scan(first, count, [&](double price) {
+            low = min(low, price);
+            high = max(high, price);
+            total += price;
+            last = price;
+            seen++;
+        });
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        long long firstTick = history.totalTicks() - history.keptTicks();
+        cout << getSymbol() << " ticks " << firstTick + max(first, 0LL) << "-" << firstTick + max(first, 0LL) + seen - 1
+             << " (" << seen << " prices): ";
+        if (seen == 0) {
+            cout << "none kept\n";
+            return;
+        }
+        cout << fixed << setprecision(2) << "min " << low << ", max " << high << ", mean " << total / seen
+             << ", last " << last << setprecision(3) << " in " << seconds * 1000 << " ms\n";
+    }
+};
+
+// Sorted Holdings for Portfolio
+// Positions live in one vector kept sorted by SymbolId: binary-search lookup,
+// no per-position allocation and in-order iteration without recursion.
+class Holdings {
+public:
+    struct Position {
+        SymbolId symbol;
+        int shares;
+        double cost;  // total paid for the shares still held (average-cost basis)
+    };
+
+private:
+    vector<Position> positions;
+
+    static bool symbolLess(const Position& position, SymbolId symbol) {
+        return position.symbol < symbol;
+    }
+
+public:
+    int get(SymbolId symbol) const {
+        auto it = lower_bound(positions.begin(), positions.end(), symbol, symbolLess);
+        return (it != positions.end() && it->symbol == symbol) ? it->shares : 0;
+    }
+
+    double cost(SymbolId symbol) const {
+        auto it = lower_bound(positions.begin(), positions.end(), symbol, symbolLess);
+        return (it != positions.end() && it->symbol == symbol) ? it->cost : 0.0;
+    }
+
+    // Adds (or with a negative delta removes) shares and their cost; empty positions are dropped
+    void add(SymbolId symbol, int deltaShares, double deltaCost) {
+        auto it = lower_bound(positions.begin(), positions.end(), symbol, symbolLess);
+        if (it != positions.end() && it->symbol == symbol) {
+            it->shares += deltaShares;
+            it->cost += deltaCost;
+            if (it->shares <= 0) {
+                positions.erase(it);
+            }
+        } else if (deltaShares > 0) {
+            positions.insert(it, Position{symbol, deltaShares, deltaCost});
+        }
+    }
+
+    size_t size() const { return positions.size(); }
+    bool empty() const { return positions.empty(); }
+    vector<Position>::const_iterator begin() const { return positions.begin(); }
+    vector<Position>::const_iterator end() const { return positions.end(); }
+};
+
+// Binary Trade Journal
+// Fixed-width trade records in an append-only array. By default the array
+// lives in memory; after open() it is a memory-mapped file (header + records)
+// that is msync'ed every `groupSize` appends (group commit). A per-symbol list
+// of record numbers, in time order, serves range queries by symbol and time.
+// Symbol IDs in a journal file refer to the SymbolTable of the writing process.
+struct TradeRecord {
+    int64_t timestamp;   // nanoseconds since the epoch
+    uint32_t symbol;
+    int32_t quantity;
+    double price;
+    uint8_t side;        // 0 = buy, 1 = sell
+    uint8_t reserved[7];
+};
+static_assert(sizeof(TradeRecord) == 32, "TradeRecord must stay 32 bytes");
+
+class TradeJournal {
+private:
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t recordSize;
+        uint64_t recordCount;
+        uint8_t reserved[40];
+    };
+    static_assert(sizeof(FileHeader) == 64, "FileHeader must stay 64 bytes");
+
+    vector<TradeRecord> memory;      // storage when not file-backed
+    TradeRecord* records;
+    size_t count;
+    size_t capacity;
+    int64_t lastTimestamp;
+    unordered_map<SymbolId, vector<uint32_t>> bySymbol;  // sparse: a journal touches few symbols
+
+    int fd;
+    char* mapping;
+    size_t mappedBytes;
+    size_t groupSize;
+    size_t uncommitted;
+
+    void grow() {
+#ifndef _WIN32
+        if (fd != -1) {
+            size_t newCapacity = max<size_t>(capacity * 2, 1024);
+            commit(false);
+            size_t bytes = sizeof(FileHeader) + newCapacity * sizeof(TradeRecord);
+            if (ftruncate(fd, (off_t)bytes) != 0) {
+                throw runtime_error("Cannot grow trade journal");
+            }
+            munmap(mapping, mappedBytes);
+            void* mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (mapped == MAP_FAILED) {
+                throw runtime_error("Cannot map trade journal");
+            }
+            mapping = (char*)mapped;
+            mappedBytes = bytes;
+            records = (TradeRecord*)(mapping + sizeof(FileHeader));
+            capacity = newCapacity;
+            return;
+        }
+#endif
+        // In-memory journals start small: a manager may hold many thousands of them
+        size_t newCapacity = max<size_t>(capacity * 2, 16);
+        memory.resize(newCapacity);
+        records = memory.data();
+        capacity = newCapacity;
+    }
+
+    void closeFile() {
+#ifndef _WIN32
+        if (fd != -1) {
+            commit(true);
+            munmap(mapping, mappedBytes);
+            ::close(fd);
+        }
+#endif
+        fd = -1;
+        mapping = nullptr;
+        mappedBytes = 0;
+    }
+
+public:
+    TradeJournal() : records(nullptr), count(0), capacity(0), lastTimestamp(0),
+        fd(-1), mapping(nullptr), mappedBytes(0), groupSize(64), uncommitted(0) {}
+
+    ~TradeJournal() { closeFile(); }
+
+    TradeJournal(TradeJournal&& other) noexcept : TradeJournal() { swap(other); }
+    TradeJournal& operator=(TradeJournal&& other) noexcept {
+        swap(other);
+        return *this;
+    }
+    TradeJournal(const TradeJournal&) = delete;
+    TradeJournal& operator=(const TradeJournal&) = delete;
+
+    void swap(TradeJournal& other) noexcept {
+        std::swap(memory, other.memory);
+        std::swap(records, other.records);
+        std::swap(count, other.count);
+        std::swap(capacity, other.capacity);
+        std::swap(lastTimestamp, other.lastTimestamp);
+        std::swap(bySymbol, other.bySymbol);
+        std::swap(fd, other.fd);
+        std::swap(mapping, other.mapping);
+        std::swap(mappedBytes, other.mappedBytes);
+        std::swap(groupSize, other.groupSize);
+        std::swap(uncommitted, other.uncommitted);
+    }
+
+    // Opens or creates the journal file at `path`. Records the file already
+    // holds are recovered (count from the header, per-symbol index rebuilt),
+    // and the records written so far in memory are appended after them.
+    void open(const string& path, size_t commitEvery = 64) {
+#ifndef _WIN32
+        int file = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (file == -1) {
+            throw runtime_error("Cannot open trade journal " + path);
+        }
+        struct stat info;
+        if (fstat(file, &info) != 0) {
+            ::close(file);
+            throw runtime_error("Cannot open trade journal " + path);
+        }
+        size_t fileBytes = (size_t)info.st_size;
+        size_t recovered = 0;
+        size_t fileCapacity = 0;
+        if (fileBytes > 0) {
+            FileHeader header;
+            fileCapacity = fileBytes >= sizeof(FileHeader) ? (fileBytes - sizeof(FileHeader)) / sizeof(TradeRecord) : 0;
+            if (fileBytes < sizeof(FileHeader) || pread(file, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+                memcmp(header.magic, "STNKJRNL", 8) != 0 || header.recordSize != sizeof(TradeRecord) ||
+                header.recordCount > fileCapacity) {
+                ::close(file);
+                throw runtime_error("Not a trade journal: " + path);
+            }
+            recovered = header.recordCount;
+        }
+
+        size_t newCapacity = max<size_t>({recovered + count, fileCapacity, 1024});
+        size_t bytes = sizeof(FileHeader) + newCapacity * sizeof(TradeRecord);
+        void* mapped = MAP_FAILED;
+        if (ftruncate(file, (off_t)bytes) == 0) {
+            mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+        }
+        if (mapped == MAP_FAILED) {
+            ::close(file);
+            throw runtime_error("Cannot map trade journal " + path);
+        }
+        FileHeader* header = (FileHeader*)mapped;
+        if (recovered == 0) {
+            memcpy(header->magic, "STNKJRNL", 8);
+            header->version = 1;
+            header->recordSize = sizeof(TradeRecord);
+            header->recordCount = 0;
+        }
+        TradeRecord* fileRecords = (TradeRecord*)((char*)mapped + sizeof(FileHeader));
+        if (count > 0) {
+            memcpy(fileRecords + recovered, records, count * sizeof(TradeRecord));
+        }
+        size_t total = recovered + count;
+
+        closeFile();
+        fd = file;
+        mapping = (char*)mapped;
+        mappedBytes = bytes;
+        records = fileRecords;
+        count = total;
+        capacity = newCapacity;
+        vector<TradeRecord>().swap(memory);
+        groupSize = max<size_t>(commitEvery, 1);
+
+        bySymbol.clear();
+        lastTimestamp = 0;
+        for (size_t i = 0; i < count; ++i) {
+            lastTimestamp = max(records[i].timestamp, lastTimestamp);
+            records[i].timestamp = lastTimestamp;
+            bySymbol[records[i].symbol].push_back((uint32_t)i);
+        }
+        commit(true);
+#else
+        (void)path;
+        (void)commitEvery;
+        throw runtime_error("File-backed journals need mmap support");
+#endif
+    }
+
+    // Publishes the record count and flushes dirty pages; `wait` blocks until on disk
+    void commit(bool wait) {
+#ifndef _WIN32
+        if (fd == -1) return;
+        ((FileHeader*)mapping)->recordCount = count;
+        msync(mapping, sizeof(FileHeader) + count * sizeof(TradeRecord), wait ? MS_SYNC : MS_ASYNC);
+#else
+        (void)wait;
+#endif
+        uncommitted = 0;
+    }
+
+    void append(bool buy, SymbolId symbol, int quantity, double price) {
+        int64_t now = chrono::duration_cast<chrono::nanoseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+
+        TradeRecord record;
+        record.timestamp = now;
+        record.symbol = symbol;
+        record.quantity = quantity;
+        record.price = price;
+        record.side = buy ? 0 : 1;
+        memset(record.reserved, 0, sizeof(record.reserved));
+        appendRecord(record);
+    }
+
+    // Appends a prepared record (e.g. from a snapshot), keeping timestamps non-decreasing
+    void appendRecord(const TradeRecord& source) {
+        if (count == capacity) grow();
+
+        TradeRecord& record = records[count];
+        record = source;
+        lastTimestamp = max(record.timestamp, lastTimestamp);  // keep per-symbol lists time-ordered
+        record.timestamp = lastTimestamp;
+
+        bySymbol[record.symbol].push_back((uint32_t)count);
+        count++;
+
+        if (fd != -1 && ++uncommitted >= groupSize) commit(false);
+    }
+
+    size_t size() const { return count; }
+    const TradeRecord& operator[](size_t index) const { return records[index]; }
+    bool isFileBacked() const { return fd != -1; }
+
+    // Calls visit(record) for the symbol's trades with from <= timestamp <= to
+    template <typename Visitor>
+    void forEachInRange(SymbolId symbol, int64_t from, int64_t to, Visitor visit) const {
+        auto found = bySymbol.find(symbol);
+        if (found == bySymbol.end()) return;
+        const vector<uint32_t>& indices = found->second;
+        auto first = lower_bound(indices.begin(), indices.end(), from,
+            [&](uint32_t index, int64_t time) { return records[index].timestamp < time; });
+        for (auto it = first; it != indices.end() && records[*it].timestamp <= to; ++it) {
+            visit(records[*it]);
+        }
+    }
+};
+
+class Portfolio {
+private:
+    Holdings positions;
+    double cash;
+    double costBasis;     // sum of position costs
+    double realizedPnL;
+    TradeJournal transactionHistory;
+
+public:
+    Portfolio(double initialCash = 10000.0) : cash(initialCash), costBasis(0.0), realizedPnL(0.0) {}
+
+    Portfolio(Portfolio&&) = default;
+    Portfolio& operator=(Portfolio&&) = default;
+    Portfolio(const Portfolio&) = delete;
+    Portfolio& operator=(const Portfolio&) = delete;
+
+    // Trades allocate on growth only: the journal's records and per-symbol
+    // index double as they fill, and a first position in a symbol may grow
+    // the holdings. That is amortized O(1) per trade, not zero; unlike the
+    // tick path, trades are not pre-sized from an arena.
+    void buyStock(Stock& stock, int shares) {
+        ScopedLatency latency(Metric::Buy);
+        if (shares <= 0) throw runtime_error("Share count must be positive");
+        double price = stock.getCurrentPrice();  // read once: the market may tick concurrently
+        double cost = shares * price;
+        if (cost <= cash) {
+            stock.buyShares(shares);
+            positions.add(stock.getId(), shares, cost);
+            cash -= cost;
+            costBasis += cost;
+
+            // Record transaction
+            transactionHistory.append(true, stock.getId(), shares, price);
+        } else {
+            throw runtime_error("Insufficient funds");
+        }
+    }
+
+    void sellStock(Stock& stock, int shares) {
+    ScopedLatency latency(Metric::Sell);
+    if (shares <= 0) throw runtime_error("Share count must be positive");  // held may be 0 below
+    int held = holdings(stock.getId());
+    if (held >= shares) {
+        stock.sellShares(shares);
+        double price = stock.getCurrentPrice();
+        double soldCost = positions.cost(stock.getId()) * shares / held;
+        double proceeds = shares * price;
+        positions.add(stock.getId(), -shares, -soldCost); // Update the number of shares
+        cash += proceeds;
+        costBasis -= soldCost;
+        realizedPnL += proceeds - soldCost;
+
+        // Record transaction
+        transactionHistory.append(false, stock.getId(), shares, price);
+    } else {
+        throw runtime_error("Not enough shares in portfolio");
+    }
+}
+
+
+    int holdings(SymbolId symbol) const {
+        return positions.get(symbol);
+    }
+
+    int holdings(const string& symbol) const {
+        return positions.get(symbolTable().find(symbol));
+    }
+
+    const Holdings& getHoldings() const { return positions; }
+    double getCash() const { return cash; }
+    double getCostBasis() const { return costBasis; }
+    double getRealizedPnL() const { return realizedPnL; }
+    TradeJournal& getJournal() { return transactionHistory; }
+    const TradeJournal& getJournal() const { return transactionHistory; }
+
+    void displayPortfolioSummary() const {
+        cout << "\n=== Portfolio Summary ===\n";
+        cout << "Cash: $" << fixed << setprecision(2) << cash << "\n";
+        cout << "Cost basis: $" << costBasis << "\n";
+        cout << "Realized P&L: $" << realizedPnL << "\n\n";
+        cout << "Holdings:\n";
+        vector<SymbolId> symbols;
+        for (const auto& position : positions) {
+            symbols.push_back(position.symbol);
+        }
+        sortByName(symbols);
+        for (SymbolId symbol : symbols) {
+            cout << symbolTable().name(symbol) << ": " << positions.get(symbol) << " shares (cost $"
+                 << positions.cost(symbol) << ")\n";
+        }
+    }
+
+    void save(SnapshotWriter& out) const {
+        out.put<double>(cash);
+        out.put<double>(realizedPnL);
+        out.put<uint64_t>(positions.size());
+        for (const auto& position : positions) {
+            out.put<uint32_t>(position.symbol);
+            out.put<int32_t>(position.shares);
+            out.put<double>(position.cost);
+        }
+        out.put<uint64_t>(transactionHistory.size());
+        for (size_t i = 0; i < transactionHistory.size(); ++i) {
+            out.put(transactionHistory[i]);
+        }
+    }
+
+    // Restores into a freshly constructed portfolio
+    void restore(SnapshotReader& in) {
+        cash = in.get<double>();
+        realizedPnL = in.get<double>();
+        uint64_t positionCount = in.getCount(sizeof(uint32_t) + sizeof(int32_t) + sizeof(double));
+        for (uint64_t i = 0; i < positionCount; ++i) {
+            SymbolId symbol = in.getSymbol();
+            int shares = in.get<int32_t>();
+            double cost = in.get<double>();
+            positions.add(symbol, shares, cost);
+            costBasis += cost;
+        }
+        uint64_t recordCount = in.getCount(sizeof(TradeRecord));
+        for (uint64_t i = 0; i < recordCount; ++i) {
+            TradeRecord record = in.get<TradeRecord>();
+            record.symbol = in.mapSymbol(record.symbol);
+            transactionHistory.appendRecord(record);
+        }
+    }
+
+    static void displayTransaction(const TradeRecord& record) {
+        cout << (record.side == 0 ? "Bought " : "Sold ") << record.quantity << " shares of "
+             << symbolTable().name(record.symbol) << " at $" << to_string(record.price) << "\n";
+    }
+
+    void displayTransactionHistory() const {
+        cout << "\n=== Transaction History ===\n";
+        for (size_t i = 0; i < transactionHistory.size(); ++i) {
+            displayTransaction(transactionHistory[i]);
+        }
+    }
+
+    // Trades in one symbol between two timestamps (nanoseconds since the epoch)
+    void displayTransactionHistory(SymbolId symbol, int64_t from, int64_t to) const {
+        cout << "\n=== Transaction History: " << symbolTable().name(symbol) << " ===\n";
+        transactionHistory.forEachInRange(symbol, from, to, displayTransaction);
+    }
+};
+
+// Indexed Max-Heap for Top N Stocks
+// Holds at most one entry per symbol; `position` maps a SymbolId to its heap
+// slot so a changed key is sifted up or down in place (increase/decrease-key).
+enum class RankKey { Price, PercentChange, Volume };
+
+class MaxHeap {
+private:
+    vector<pair<SymbolId, double>> heap;
+    vector<int> position;  // heap slot per SymbolId, -1 when absent
+
+    void place(int index) {
+        position[heap[index].first] = index;
+    }
+
+    void heapifyUp(int index) {
+        while (index > 0) {
+            int parent = (index - 1) / 2;
+            if (heap[index].second > heap[parent].second) {
+                swap(heap[index], heap[parent]);
+                place(index);
+                index = parent;
+            } else {
+                break;
+            }
+        }
+        place(index);
+    }
+
+    void heapifyDown(int index) {
+        int size = heap.size();
+        while (index < size) {
+            int left = 2 * index + 1;
+            int right = 2 * index + 2;
+            int largest = index;
+
+            if (left < size && heap[left].second > heap[largest].second) {
+                largest = left;
+            }
+            if (right < size && heap[right].second > heap[largest].second) {
+                largest = right;
+            }
+            if (largest != index) {
+                swap(heap[index], heap[largest]);
+                place(index);
+                index = largest;
+            } else {
+                break;
+            }
+        }
+        if (index < size) place(index);
+    }
+
+public:
+    // Inserts the symbol or moves its existing entry to the new key
+    void update(SymbolId symbol, double key) {
+        if (symbol >= position.size()) {
+            position.resize(symbol + 1, -1);
+        }
+        int index = position[symbol];
+        if (index == -1) {
+            heap.emplace_back(symbol, key);
+            heapifyUp(heap.size() - 1);
+        } else if (key > heap[index].second) {
+            heap[index].second = key;
+            heapifyUp(index);
+        } else {
+            heap[index].second = key;
+            heapifyDown(index);
+        }
+    }
+
+    void remove(SymbolId symbol) {
+        if (symbol >= position.size() || position[symbol] == -1) return;
+        int index = position[symbol];
+        position[symbol] = -1;
+        heap[index] = heap.back();
+        heap.pop_back();
+        if (index < (int)heap.size()) {
+            heapifyUp(index);
+            heapifyDown(position[heap[index].first]);
+        }
+    }
+
+    void removeMax() {
+        if (!heap.empty()) remove(heap[0].first);
+    }
+
+    size_t size() const { return heap.size(); }
+    void clear() {
+        heap.clear();
+        position.clear();
+    }
+
+    // Best N entries in descending order without disturbing the heap: a small
+    // frontier heap of slot indices walks the tree, so this is O(N log N).
+    vector<pair<SymbolId, double>> topN(int N) const {
+        vector<pair<SymbolId, double>> result;
+        if (heap.empty() || N <= 0) return result;
+
+        auto lower = [&](int a, int b) { return heap[a].second < heap[b].second; };
+        vector<int> frontier(1, 0);
+        while (!frontier.empty() && (int)result.size() < N) {
+            pop_heap(frontier.begin(), frontier.end(), lower);
+            int index = frontier.back();
+            frontier.pop_back();
+            result.push_back(heap[index]);
+            for (int child = 2 * index + 1; child <= 2 * index + 2; ++child) {
+                if (child < (int)heap.size()) {
+                    frontier.push_back(child);
+                    push_heap(frontier.begin(), frontier.end(), lower);
+                }
+            }
+        }
+        return result;
+    }
+
+    void displayTopN(int N, RankKey key = RankKey::Price) const {
+        const char* label = key == RankKey::Price ? "price" : key == RankKey::PercentChange ? "% change" : "volume";
+        cout << "\n=== Top " << N << " Stocks by " << label << " ===\n";
+        for (const auto& entry : topN(N)) {
+            cout << symbolTable().name(entry.first) << ": ";
+            if (key == RankKey::Price) {
+                cout << "$" << fixed << setprecision(2) << entry.second << "\n";
+            } else if (key == RankKey::PercentChange) {
+                cout << fixed << setprecision(2) << entry.second << "%\n";
+            } else {
+                cout << (long long)entry.second << " shares\n";
+            }
+        }
+    }
+};
+
+// Work-Stealing Worker Pool
+// parallelFor splits [0, n) into one partition per thread. Each thread takes
+// `grain`-sized chunks from its own partition first, then steals chunks from
+// the others, so uneven work still finishes together. The calling thread
+// takes part as worker 0.
+class WorkerPool {
+private:
+    struct alignas(64) Partition {
+        atomic<size_t> next{0};
+        size_t end = 0;
+    };
+
+    vector<thread> workers;
+    unique_ptr<Partition[]> partitions;
+    size_t partitionCount;
+
+    mutex lock;
+    condition_variable wake;
+    condition_variable finished;
+    long long generation;
+    size_t pending;
+    bool stopping;
+    void* body;                                   // the caller's callable, valid during parallelFor
+    void (*invoke)(void*, size_t, size_t);
+    size_t grain;
+
+    void runChunks(size_t self) {
+        for (size_t k = 0; k < partitionCount; ++k) {
+            Partition& partition = partitions[(self + k) % partitionCount];
+            while (true) {
+                size_t begin = partition.next.fetch_add(grain);
+                if (begin >= partition.end) break;
+                invoke(body, begin, min(begin + grain, partition.end));
+            }
+        }
+    }
+
+    void workerLoop(size_t self) {
+        long long seen = 0;
+        while (true) {
+            {
+                unique_lock<mutex> guard(lock);
+                wake.wait(guard, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            runChunks(self);
+            {
+                lock_guard<mutex> guard(lock);
+                if (--pending == 0) finished.notify_one();
+            }
+        }
+    }
+
+public:
+    explicit WorkerPool(size_t threads) :
+        partitions(new Partition[max<size_t>(threads, 1)]), partitionCount(max<size_t>(threads, 1)),
+        generation(0), pending(0), stopping(false), body(nullptr), invoke(nullptr), grain(1) {
+        for (size_t i = 1; i < partitionCount; ++i) {
+            workers.emplace_back(&WorkerPool::workerLoop, this, i);
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    size_t threadCount() const { return partitionCount; }
+
+    // Calls work(begin, end) over disjoint chunks covering [0, n); returns when all are done.
+    // The callable is used in place (no std::function), so dispatch never allocates.
+    template <typename Work>
+    void parallelFor(size_t n, size_t chunk, Work& work) {
+        if (partitionCount == 1 || n <= chunk) {
+            if (n > 0) work(0, n);
+            return;
+        }
+        size_t share = (n + partitionCount - 1) / partitionCount;
+        for (size_t i = 0; i < partitionCount; ++i) {
+            partitions[i].next.store(min(i * share, n), memory_order_relaxed);
+            partitions[i].end = min((i + 1) * share, n);
+        }
+        {
+            lock_guard<mutex> guard(lock);
+            body = &work;
+            invoke = [](void* callable, size_t begin, size_t end) { (*static_cast<Work*>(callable))(begin, end); };
+            grain = max<size_t>(chunk, 1);
+            pending = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        runChunks(0);
+
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [&] { return pending == 0; });
+    }
+};
+
+// Runs work(begin, end) over [0, n) on the pool, or inline when there is none
+template <typename Work>
+void runParallel(WorkerPool* pool, size_t n, size_t grain, Work& work) {
+    if (pool) {
+        pool->parallelFor(n, grain, work);
+    } else if (n > 0) {
+        work(0, n);
+    }
+}
+
+// Graph for Market Relationships
+// Undirected weighted edges are kept in a hash map keyed by the symbol pair,
+// so adding an existing edge raises its weight instead of duplicating it.
+// Analytics run on a compressed sparse row (CSR) view rebuilt lazily after
+// edits: offsets[v]..offsets[v+1] index v's neighbours in targets/weights.
+class Graph {
+private:
+    unordered_map<uint64_t, double> edges;
+
+    mutable bool dirty;
+    mutable vector<uint64_t> offsets;
+    mutable vector<SymbolId> targets;
+    mutable vector<double> weights;
+
+    static uint64_t edgeKey(SymbolId a, SymbolId b) {
+        if (a > b) swap(a, b);
+        return ((uint64_t)a << 32) | b;
+    }
+
+    void buildCsr() const {
+        if (!dirty) return;
+        SymbolId vertices = 0;
+        for (const auto& edge : edges) {
+            vertices = max(vertices, (SymbolId)(edge.first & 0xffffffffU) + 1);
+        }
+
+        offsets.assign((size_t)vertices + 1, 0);
+        for (const auto& edge : edges) {
+            offsets[(edge.first >> 32) + 1]++;
+            offsets[(edge.first & 0xffffffffU) + 1]++;
+        }
+        for (size_t v = 0; v < vertices; ++v) {
+            offsets[v + 1] += offsets[v];
+        }
+
+        vector<pair<SymbolId, double>> adjacency(offsets[vertices]);
+        vector<uint64_t> cursor(offsets.begin(), offsets.end() - 1);
+        for (const auto& edge : edges) {
+            SymbolId a = (SymbolId)(edge.first >> 32);
+            SymbolId b = (SymbolId)(edge.first & 0xffffffffU);
+            adjacency[cursor[a]++] = make_pair(b, edge.second);
+            adjacency[cursor[b]++] = make_pair(a, edge.second);
+        }
+        targets.resize(adjacency.size());
+        weights.resize(adjacency.size());
+        for (size_t v = 0; v < vertices; ++v) {
+            sort(adjacency.begin() + offsets[v], adjacency.begin() + offsets[v + 1]);
+        }
+        for (size_t i = 0; i < adjacency.size(); ++i) {
+            targets[i] = adjacency[i].first;
+            weights[i] = adjacency[i].second;
+        }
+        dirty = false;
+    }
+
+    static SymbolId findRoot(const unique_ptr<atomic<SymbolId>[]>& parent, SymbolId v) {
+        while (true) {
+            SymbolId p = parent[v].load(memory_order_relaxed);
+            if (p == v) return v;
+            SymbolId grandparent = parent[p].load(memory_order_relaxed);
+            parent[v].compare_exchange_weak(p, grandparent, memory_order_relaxed);  // path halving
+            v = grandparent;
+        }
+    }
+
+public:
+    Graph() : dirty(false) {}
+
+    void addEdge(SymbolId stock1, SymbolId stock2, double weight = 1.0) {
+        if (stock1 == stock2) return;
+        edges[edgeKey(stock1, stock2)] += weight;
+        dirty = true;
+    }
+
+    // Sets (weight > 0) or removes (weight <= 0) the edge
+    void setEdge(SymbolId stock1, SymbolId stock2, double weight) {
+        if (stock1 == stock2) return;
+        if (weight > 0) {
+            edges[edgeKey(stock1, stock2)] = weight;
+        } else {
+            edges.erase(edgeKey(stock1, stock2));
+        }
+        dirty = true;
+    }
+
+    size_t edgeCount() const { return edges.size(); }
+    size_t vertexCount() const {
+        buildCsr();
+        return offsets.empty() ? 0 : offsets.size() - 1;
+    }
+
+    size_t degree(SymbolId v) const {
+        buildCsr();
+        return v + 1 < offsets.size() ? (size_t)(offsets[v + 1] - offsets[v]) : 0;
+    }
+
+    // Level-synchronous BFS over edges with weight >= minWeight. Returns the hop
+    // count per vertex (-1 = unreached), stopping after maxDepth hops. Each level
+    // expands its frontier in parallel; vertices are claimed with a CAS.
+    vector<int> bfs(SymbolId source, int maxDepth, double minWeight = 0.0, WorkerPool* pool = nullptr) const {
+        if (source == INVALID_SYMBOL || source >= symbolTable().size()) {
+            throw runtime_error("Stock not found");
+        }
+        buildCsr();
+        size_t n = vertexCount();
+        vector<int> depth(max(n, (size_t)source + 1), -1);
+        if (source >= n) {
+            depth[source] = 0;
+            return depth;
+        }
+
+        unique_ptr<atomic<int>[]> claimed(new atomic<int>[n]);
+        for (size_t v = 0; v < n; ++v) claimed[v].store(-1, memory_order_relaxed);
+        claimed[source].store(0, memory_order_relaxed);
+
+        vector<SymbolId> frontier(1, source);
+        vector<SymbolId> next;
+        mutex nextLock;
+        for (int level = 0; level < maxDepth && !frontier.empty(); ++level) {
+            next.clear();
+            auto expand = [&](size_t begin, size_t end) {
+                vector<SymbolId> found;
+                for (size_t i = begin; i < end; ++i) {
+                    SymbolId v = frontier[i];
+                    for (uint64_t e = offsets[v]; e < offsets[v + 1]; ++e) {
+                        int unvisited = -1;
+                        if (weights[e] >= minWeight &&
+                            claimed[targets[e]].load(memory_order_relaxed) == -1 &&
+                            claimed[targets[e]].compare_exchange_strong(unvisited, level + 1, memory_order_relaxed)) {
+                            found.push_back(targets[e]);
+                        }
+                    }
+                }
+                lock_guard<mutex> guard(nextLock);
+                next.insert(next.end(), found.begin(), found.end());
+            };
+            runParallel(pool, frontier.size(), 256, expand);
+            frontier.swap(next);
+        }
+
+        for (size_t v = 0; v < n; ++v) {
+            depth[v] = claimed[v].load(memory_order_relaxed);
+        }
+        return depth;
+    }
+
+    // Vertices within k hops of source (excluding it), nearest first
+    vector<SymbolId> kHopNeighbors(SymbolId source, int k, WorkerPool* pool = nullptr) const {
+        vector<int> depth = bfs(source, k, 0.0, pool);
+        vector<SymbolId> result;
+        for (SymbolId v = 0; v < depth.size(); ++v) {
+            if (depth[v] > 0) result.push_back(v);
+        }
+        stable_sort(result.begin(), result.end(), [&](SymbolId a, SymbolId b) { return depth[a] < depth[b]; });
+        return result;
+    }
+
+    // Component label per vertex (the smallest SymbolId in its component), via a
+    // lock-free union-find: edges are unioned in parallel, always linking the
+    // larger root under the smaller, then every vertex is resolved to its root.
+    vector<SymbolId> connectedComponents(WorkerPool* pool = nullptr) const {
+        buildCsr();
+        size_t n = vertexCount();
+        unique_ptr<atomic<SymbolId>[]> parent(new atomic<SymbolId>[n]);
+        for (size_t v = 0; v < n; ++v) parent[v].store((SymbolId)v, memory_order_relaxed);
+
+        auto unite = [&](size_t begin, size_t end) {
+            for (size_t a = begin; a < end; ++a) {
+                for (uint64_t e = offsets[a]; e < offsets[a + 1]; ++e) {
+                    SymbolId b = targets[e];
+                    if (b < a) continue;  // each undirected edge once
+                    while (true) {
+                        SymbolId rootA = findRoot(parent, (SymbolId)a);
+                        SymbolId rootB = findRoot(parent, b);
+                        if (rootA == rootB) break;
+                        if (rootA < rootB) swap(rootA, rootB);
+                        SymbolId expected = rootA;
+                        if (parent[rootA].compare_exchange_strong(expected, rootB, memory_order_relaxed)) break;
+                    }
+                }
+            }
+        };
+        runParallel(pool, n, 1024, unite);
+
+        vector<SymbolId> labels(n);
+        auto resolve = [&](size_t begin, size_t end) {
+            for (size_t v = begin; v < end; ++v) {
+                labels[v] = findRoot(parent, (SymbolId)v);
+            }
+        };
+        runParallel(pool, n, 4096, resolve);
+        return labels;
+    }
+
+    void save(SnapshotWriter& out) const {
+        out.put<uint64_t>(edges.size());
+        for (const auto& edge : edges) {
+            out.put<uint32_t>((uint32_t)(edge.first >> 32));
+            out.put<uint32_t>((uint32_t)(edge.first & 0xffffffffU));
+            out.put<double>(edge.second);
+        }
+    }
+
+    void restore(SnapshotReader& in) {
+        edges.clear();
+        uint64_t n = in.getCount(2 * sizeof(uint32_t) + sizeof(double));
+        for (uint64_t i = 0; i < n; ++i) {
+            SymbolId a = in.getSymbol();
+            SymbolId b = in.getSymbol();
+            if (a == INVALID_SYMBOL || b == INVALID_SYMBOL) {
+                throw runtime_error("Snapshot has a relationship without a stock");
+            }
+            setEdge(a, b, in.get<double>());
+        }
+        dirty = true;
+    }
+
+    void displayRelationships() const {
+        buildCsr();
+        cout << "\n=== Stock Relationships ===\n";
+        vector<SymbolId> symbols;
+        for (SymbolId v = 0; v < vertexCount(); ++v) {
+            if (degree(v) > 0) symbols.push_back(v);
+        }
+        sortByName(symbols);
+        for (SymbolId symbol : symbols) {
+            cout << symbolTable().name(symbol) << " is related to: ";
+            for (uint64_t e = offsets[symbol]; e < offsets[symbol + 1]; ++e) {
+                cout << symbolTable().name(targets[e]);
+                if (weights[e] != 1.0) {
+                    cout << " (" << fixed << setprecision(2) << weights[e] << ")";
+                }
+                cout << " ";
+            }
+            cout << "\n";
+        }
+    }
+};
+
+// Structure-of-Arrays Tick Engine
+// Prices, shares and volatility live in parallel arrays indexed by symbol ID
+// so a market tick is a straight pass over contiguous memory. The kernel in
+// advanceRange vectorizes at -O3 (add -march=native for AVX2).
+class TickEngine {
+private:
+    vector<double> prices;
+    vector<double> volatility;
+    vector<int> shares;
+    uint64_t seed;
+    long long tick;
+
+public:
+    TickEngine(uint64_t s = 42) : seed(s), tick(0) {}
+
+    size_t addSymbol(double price, int availableShares, double vol = 1.0) {
+        prices.push_back(price);
+        volatility.push_back(vol);
+        shares.push_back(availableShares);
+        return prices.size() - 1;
+    }
+
+    // Random walk with the 0.01 floor for symbols [begin, end) at the given tick
+    void advanceRange(size_t begin, size_t end, long long atTick) {
+        const uint32_t key = tickKey(seed, atTick);
+        double* __restrict price = prices.data();
+        const double* __restrict vol = volatility.data();
+        for (size_t id = begin; id < end; ++id) {
+            price[id] = max(0.01, price[id] + randomStep(key, (uint32_t)id, vol[id]));
+        }
+    }
+
+    void advance() {
+        advanceRange(0, prices.size(), tick);
+        tick++;
+    }
+
+    // For callers that run advanceRange themselves (e.g. across a WorkerPool)
+    void finishTick() { tick++; }
+
+    size_t size() const { return prices.size(); }
+    long long getTick() const { return tick; }
+    uint64_t getSeed() const { return seed; }
+    void setSeed(uint64_t s) { seed = s; }
+    void setTick(long long t) { tick = t; }
+
+    void clear() {
+        prices.clear();
+        volatility.clear();
+        shares.clear();
+        tick = 0;
+    }
+
+    double getPrice(size_t id) const { return prices[id]; }
+    void setPrice(size_t id, double price) { prices[id] = price; }
+    int getShares(size_t id) const { return shares[id]; }
+    void setShares(size_t id, int count) { shares[id] = count; }
+    double getVolatility(size_t id) const { return volatility[id]; }
+    const double* priceData() const { return prices.data(); }
+    void setVolatility(size_t id, double vol) { volatility[id] = vol; }
+};
+
+// Streaming Correlation Engine
+// Rolling Pearson correlation of per-tick returns over the last `window` ticks
+// for a tracked set of stocks. Running sums (Σx, Σx², Σxy per pair) are updated
+// per tick by adding the newest return and subtracting the one leaving the
+// window, which costs O(n²) per tick rather than O(n² · window). Pair sums sit
+// in the upper triangle of an n×n row-major matrix; each row update is a
+// contiguous loop that vectorizes, and rows are spread over the WorkerPool.
+// Sums are rebuilt from the return ring every RESYNC_WINDOWS windows so
+// floating-point drift from the add/subtract cycle cannot accumulate.
+class CorrelationEngine {
+private:
+    static constexpr size_t RESYNC_WINDOWS = 64;
+
+    vector<size_t> members;      // market indices of tracked stocks
+    size_t window;
+    vector<double> lastPrice;
+    vector<double> returns;      // ring of `window` rows, n returns each
+    size_t filled;
+    size_t nextRow;
+    bool primed;
+    size_t ticksSinceResync;
+
+    vector<double> sumX;
+    vector<double> sumXX;
+    vector<double> sumXY;        // upper triangle, row i holds pairs (i, j >= i)
+    vector<double> current;
+    vector<double> leaving;
+
+    void accumulateRows(WorkerPool* pool, const double* add, const double* remove) {
+        const size_t n = members.size();
+        auto rows = [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                const double addI = add[i];
+                const double removeI = remove[i];
+                double* __restrict row = &sumXY[i * n];
+                for (size_t j = i; j < n; ++j) {
+                    row[j] += addI * add[j] - removeI * remove[j];
+                }
+            }
+        };
+        runParallel(pool, n, 16, rows);
+    }
+
+    void resync(WorkerPool* pool) {
+        const size_t n = members.size();
+        fill(sumX.begin(), sumX.end(), 0.0);
+        fill(sumXX.begin(), sumXX.end(), 0.0);
+        fill(sumXY.begin(), sumXY.end(), 0.0);
+        vector<double> none(n, 0.0);
+        for (size_t r = 0; r < filled; ++r) {
+            const double* row = &returns[r * n];
+            for (size_t i = 0; i < n; ++i) {
+                sumX[i] += row[i];
+                sumXX[i] += row[i] * row[i];
+            }
+            accumulateRows(pool, row, none.data());
+        }
+        ticksSinceResync = 0;
+    }
+
+public:
+    // Pair sums grow as n^2 and the return ring as window x n; beyond these
+    // the engine would need gigabytes
+    static constexpr size_t MAX_MEMBERS = 4096;          // 128 MB of pair sums
+    static constexpr size_t MAX_RETURNS = size_t(1) << 24;  // 128 MB of returns
+
+    CorrelationEngine(const vector<size_t>& trackedIndices, size_t windowTicks) :
+        members(trackedIndices), window(max<size_t>(windowTicks, 2)), filled(0), nextRow(0),
+        primed(false), ticksSinceResync(0) {
+        const size_t n = members.size();
+        lastPrice.assign(n, 0.0);
+        returns.assign(window * n, 0.0);
+        sumX.assign(n, 0.0);
+        sumXX.assign(n, 0.0);
+        sumXY.assign(n * n, 0.0);
+        current.assign(n, 0.0);
+        leaving.assign(n, 0.0);
+    }
+
+    // prices: current price per market index (the tick engine's array)
+    void onTick(const double* prices, WorkerPool* pool = nullptr) {
+        const size_t n = members.size();
+        if (!primed) {
+            for (size_t i = 0; i < n; ++i) lastPrice[i] = prices[members[i]];
+            primed = true;
+            return;
+        }
+
+        double* row = &returns[nextRow * n];
+        for (size_t i = 0; i < n; ++i) {
+            double price = prices[members[i]];
+            current[i] = lastPrice[i] > 0 ? price / lastPrice[i] - 1.0 : 0.0;
+            lastPrice[i] = price;
+            leaving[i] = filled == window ? row[i] : 0.0;
+            sumX[i] += current[i] - leaving[i];
+            sumXX[i] += current[i] * current[i] - leaving[i] * leaving[i];
+        }
+        accumulateRows(pool, current.data(), leaving.data());
+        copy(current.begin(), current.end(), row);
+
+        nextRow = (nextRow + 1) % window;
+        filled = min(filled + 1, window);
+        if (++ticksSinceResync >= RESYNC_WINDOWS * window) {
+            resync(pool);
+        }
+    }
+
+    size_t size() const { return members.size(); }
+    size_t getWindow() const { return window; }
+    size_t samples() const { return filled; }
+    size_t memberIndex(size_t i) const { return members[i]; }
+
+    // Position of a market index in the tracked set, or -1
+    int find(size_t marketIndex) const {
+        for (size_t i = 0; i < members.size(); ++i) {
+            if (members[i] == marketIndex) return (int)i;
+        }
+        return -1;
+    }
+
+    // Pearson correlation of tracked stocks a and b over the current window (0 if undefined)
+    double correlation(size_t a, size_t b) const {
+        if (a > b) swap(a, b);
+        const double count = (double)filled;
+        double covariance = count * sumXY[a * members.size() + b] - sumX[a] * sumX[b];
+        double varianceA = count * sumXX[a] - sumX[a] * sumX[a];
+        double varianceB = count * sumXX[b] - sumX[b] * sumX[b];
+        if (filled < 2 || varianceA <= 1e-18 || varianceB <= 1e-18) return 0.0;
+        return max(-1.0, min(1.0, covariance / sqrt(varianceA * varianceB)));
+    }
+};
+
+// Symbol Search Index
+// Listed tickers sorted into one packed character buffer. A prefix is a
+// contiguous range found by binary search. Fuzzy search walks a compact
+// trie stored in depth-first order (one character, depth and subtree end
+// per node), filling one Levenshtein DP row per node. Once every cell of a
+// row exceeds the bound, the walk jumps to the subtree end, so a search
+// touches only prefixes within reach of the query. The bound starts at 0
+// and widens until k names match, so close queries never pay for a wide
+// search. Matches rank by distance, then a caller-supplied score (higher
+// first), then name.
+class SymbolIndex {
+public:
+    struct Match {
+        SymbolId symbol;
+        int distance;
+        double score;
+        size_t position;  // alphabetical rank, the final tie-break
+    };
+
+private:
+    string text;
+    vector<uint32_t> offsets;  // name i is text[offsets[i], offsets[i + 1])
+    vector<SymbolId> ids;
+    size_t longest;
+
+    // Trie nodes in depth-first order; node k covers nodes [k, subtreeEnd[k])
+    static constexpr uint32_t NO_NAME = numeric_limits<uint32_t>::max();
+    vector<char> nodeChar;
+    vector<uint16_t> nodeDepth;    // prefix length, 1 for a root child
+    vector<uint32_t> subtreeEnd;
+    vector<uint32_t> nodeName;     // sorted position of the name ending here, or NO_NAME
+
+    void buildTrie() {
+        nodeChar.clear();
+        nodeDepth.clear();
+        subtreeEnd.clear();
+        nodeName.clear();
+        vector<uint32_t> open;  // nodes on the current root-to-leaf path
+        string_view previous;
+        for (size_t i = 0; i < ids.size(); ++i) {
+            string_view name = nameAt(i);
+            size_t shared = 0;
+            while (shared < min(name.size(), previous.size()) && name[shared] == previous[shared]) shared++;
+            while (open.size() > shared) {
+                subtreeEnd[open.back()] = (uint32_t)nodeChar.size();
+                open.pop_back();
+            }
+            for (size_t depth = shared; depth < name.size(); ++depth) {
+                open.push_back((uint32_t)nodeChar.size());
+                nodeChar.push_back(name[depth]);
+                nodeDepth.push_back((uint16_t)(depth + 1));
+                subtreeEnd.push_back(0);
+                nodeName.push_back(NO_NAME);
+            }
+            if (!name.empty()) nodeName[open.back()] = (uint32_t)i;
+            previous = name;
+        }
+        for (uint32_t node : open) subtreeEnd[node] = (uint32_t)nodeChar.size();
+    }
+
+    string_view nameAt(size_t i) const {
+        return string_view(text.data() + offsets[i], offsets[i + 1] - offsets[i]);
+    }
+
+    // First position in [from, size) whose name is not below `key`, or
+    // with `prefixOnly`, the first after the names starting with `key`.
+    // Gallops from `from` first: most prefix ranges are short.
+    size_t partition(size_t from, string_view key, bool prefixOnly) const {
+        auto before = [&](size_t i) {
+            string_view name = nameAt(i);
+            return prefixOnly ? name.substr(0, key.size()) <= key : name < key;
+        };
+        size_t low = from, high = from, step = 1;
+        while (high < ids.size() && before(high)) {
+            low = high + 1;
+            high = min(ids.size(), high + step);
+            step *= 2;
+        }
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            if (before(mid)) low = mid + 1;
+            else high = mid;
+        }
+        return low;
+    }
+
+    static bool better(const Match& a, const Match& b) {
+        if (a.distance != b.distance) return a.distance < b.distance;
+        if (a.score != b.score) return a.score > b.score;
+        return a.position < b.position;
+    }
+
+    // Keeps the best `k` in a heap whose front is the worst kept match
+    static void offer(vector<Match>& heap, size_t k, const Match& match) {
+        if (k == 0) return;
+        if (heap.size() < k) {
+            heap.push_back(match);
+            push_heap(heap.begin(), heap.end(), better);
+        } else if (better(match, heap.front())) {
+            pop_heap(heap.begin(), heap.end(), better);
+            heap.back() = match;
+            push_heap(heap.begin(), heap.end(), better);
+        }
+    }
+
+    static vector<Match> ranked(vector<Match>& heap) {
+        sort_heap(heap.begin(), heap.end(), better);
+        return move(heap);
+    }
+
+public:
+    SymbolIndex() : offsets(1, 0), longest(0) {}
+
+    void build(const vector<SymbolId>& symbols) {
+        const SymbolTable& table = symbolTable();
+        ids = symbols;
+        sort(ids.begin(), ids.end(), [&](SymbolId a, SymbolId b) { return table.name(a) < table.name(b); });
+        text.clear();
+        offsets.assign(1, 0);
+        offsets.reserve(ids.size() + 1);
+        longest = 0;
+        for (SymbolId id : ids) {
+            const string& name = table.name(id);
+            text += name;
+            offsets.push_back((uint32_t)text.size());
+            longest = max(longest, name.size());
+        }
+        if (longest > numeric_limits<uint16_t>::max()) {
+            throw runtime_error("Symbol too long for the search index");
+        }
+        text.shrink_to_fit();
+        buildTrie();
+    }
+
+    size_t size() const { return ids.size(); }
+    size_t nodes() const { return nodeChar.size(); }
+    size_t bytes() const {
+        return text.capacity() + (offsets.capacity() + subtreeEnd.capacity() + nodeName.capacity()) * sizeof(uint32_t)
+             + ids.capacity() * sizeof(SymbolId) + nodeChar.capacity() + nodeDepth.capacity() * sizeof(uint16_t);
+    }
+
+    // Positions [first, second) of the names starting with `prefix`
+    pair<size_t, size_t> prefixRange(const string& prefix) const {
+        size_t first = partition(0, prefix, false);
+        return make_pair(first, partition(first, prefix, true));
+    }
+
+    // Up to `k` names starting with `prefix`, alphabetical unless `score` is given
+    template <typename Score>
+    vector<Match> prefix(const string& prefix, size_t k, Score score, bool useScore) const {
+        pair<size_t, size_t> range = prefixRange(prefix);
+        vector<Match> heap;
+        if (!useScore) range.second = min(range.second, range.first + k);
+        for (size_t i = range.first; i < range.second; ++i) {
+            offer(heap, k, Match{ids[i], 0, useScore ? score(ids[i]) : 0.0, i});
+        }
+        return ranked(heap);
+    }
+
+    // The best `k` names within `maxDistance` edits of `query`
+    template <typename Score>
+    vector<Match> fuzzy(const string& query, size_t k, int maxDistance, Score score) const {
+        vector<Match> heap;
+        if (k == 0 || ids.empty()) return heap;
+        vector<int> rows((longest + 1) * (query.size() + 1));
+        for (int bound = 0; bound <= maxDistance && heap.size() < k; ++bound) {
+            heap.clear();
+            fuzzyPass(query, k, bound, score, rows, heap);
+        }
+        return ranked(heap);
+    }
+
+private:
+    // One trie walk with edit bound `bound` (lowered as the heap fills)
+    template <typename Score>
+    void fuzzyPass(const string& query, size_t k, int bound, Score& score, vector<int>& rows, vector<Match>& heap) const {
+        size_t width = query.size() + 1;
+        for (size_t j = 0; j < width; ++j) rows[j] = (int)j;
+        for (size_t node = 0; node < nodeChar.size();) {
+            size_t depth = nodeDepth[node];
+            const int* above = &rows[(depth - 1) * width];
+            int* row = &rows[depth * width];
+            row[0] = (int)depth;
+            int rowMin = row[0];
+            for (size_t j = 1; j < width; ++j) {
+                int substitute = above[j - 1] + (query[j - 1] == nodeChar[node] ? 0 : 1);
+                row[j] = min(substitute, min(above[j], row[j - 1]) + 1);
+                rowMin = min(rowMin, row[j]);
+            }
+            if (rowMin > bound) {
+                node = subtreeEnd[node];
+                continue;
+            }
+            if (nodeName[node] != NO_NAME && row[width - 1] <= bound) {
+                size_t position = nodeName[node];
+                offer(heap, k, Match{ids[position], row[width - 1], score(ids[position]), position});
+                if (heap.size() == k) bound = min(bound, heap.front().distance);
+            }
+            node++;
+        }
+    }
+};
+
+// StockMarket Class
+// Stocks are stored densely in listing order; that index is also the tick
+// engine slot. marketIndex maps a SymbolId to its slot (-1 when unlisted).
+class StockMarket {
+private:
+    Arena historyArena;          // declared before stocks: outlives the histories that use it
+    size_t historyCapacity;
+    size_t historyWindow;
+    bool preallocateHistory;
+    bool compressHistory;
+    CompressedPrices::Mode historyCompression;
+    vector<Stock> stocks;
+    vector<int> marketIndex;
+    TickEngine engine;
+    unique_ptr<WorkerPool> workerPool;  // null means serial updates
+    MaxHeap topStocks;
+    RankKey rankKey;
+    Graph stockGraph;
+    unique_ptr<CorrelationEngine> correlations;  // null until trackCorrelations()
+    SymbolIndex searchIndex;
+    bool searchIndexStale;       // set by listings; the index is rebuilt on the next search
+
+    double rankValue(const Stock& stock) const {
+        return rankValue(stock, rankKey);
+    }
+
+    static double rankValue(const Stock& stock, RankKey key) {
+        switch (key) {
+            case RankKey::PercentChange:
+                return stock.getOpenPrice() > 0 ? (stock.getCurrentPrice() / stock.getOpenPrice() - 1.0) * 100.0 : 0.0;
+            case RankKey::Volume:
+                return (double)stock.getVolume();
+            default:
+                return stock.getCurrentPrice();
+        }
+    }
+
+    int indexOf(SymbolId id) const {
+        return id < marketIndex.size() ? marketIndex[id] : -1;
+    }
+
+    // With preallocation on, each history gets its full ring from historyArena
+    // up front, so ticks never allocate
+    void bindHistory(Stock& stock) {
+        if (preallocateHistory) {
+            PriceHistory& history = stock.getHistory();
+            history.useStorage(historyArena.allocateArray<double>(2 * history.getCapacity()));
+        }
+    }
+
+public:
+    StockMarket() :
+        historyCapacity(PriceHistory::DEFAULT_CAPACITY), historyWindow(PriceHistory::DEFAULT_WINDOW),
+        preallocateHistory(false), compressHistory(false), historyCompression(CompressedPrices::Mode::Lossless),
+        rankKey(RankKey::Price), searchIndexStale(true) {
+        addStock("AAPL", 150.0, 1000);
+        addStock("GOOG", 2500.0, 500);
+        addStock("MSFT", 200.0, 2000);
+        addStock("AMZN", 3000.0, 1500);
+        addStock("TSLA", 700.0, 800);
+    }
+
+    void addStock(const string& symbol, double price, int shares, double volatility = 1.0) {
+        SymbolId id = symbolTable().intern(symbol);
+        if (indexOf(id) != -1) {
+            throw runtime_error("Stock already listed: " + symbol);
+        }
+        if (id >= marketIndex.size()) {
+            marketIndex.resize(id + 1, -1);
+        }
+        marketIndex[id] = (int)stocks.size();
+        stocks.emplace_back(symbol, price, shares);
+        PriceHistory& history = stocks.back().getHistory();
+        if (history.getCapacity() != historyCapacity || history.getWindow() != historyWindow) {
+            history.setCapacity(historyCapacity);
+            history.setWindow(historyWindow);
+            history.setEmaPeriod((int)historyWindow);
+        }
+        if (compressHistory) {
+            history.setCompressedTier(historyCompression);
+        }
+        bindHistory(stocks.back());
+        engine.addSymbol(price, shares, volatility);
+        topStocks.update(id, rankValue(stocks.back()));
+        searchIndexStale = true;
+    }
+
+    // Advances one stock by its own next tick (event-driven mode): the same
+    // random walk as updateMarket, keyed on the stock's own tick count
+    void advanceStock(SymbolId id) {
+        int index = indexOf(id);
+        if (index == -1) return;
+        Stock& stock = stocks[index];
+        engine.advanceRange(index, index + 1, stock.getHistory().totalTicks());
+        stock.applyPrice(engine.getPrice(index));
+        topStocks.update(id, rankValue(stock));
+    }
+
+    // Routes a limit order through the symbol's book; trades move the engine price too
+    long long submitOrder(const string& symbol, bool buy, int quantity, double limitPrice) {
+        Stock& stock = getStock(symbol);
+        long long orderId = stock.submitOrder(buy, quantity, limitPrice);
+        engine.setPrice(indexOf(stock.getId()), stock.getCurrentPrice());
+        topStocks.update(stock.getId(), rankValue(stock));
+        return orderId;
+    }
+
+    // Lists `count` synthetic symbols (SYM0000000, SYM0000001, ...) for scale runs
+    void generateUniverse(int count) {
+        if (count < 0) throw runtime_error("Universe size must not be negative");
+        stocks.reserve(stocks.size() + count);
+        for (int i = 0; i < count; ++i) {
+            string symbol = to_string(i);
+            symbol = "SYM" + string(7 - min<size_t>(7, symbol.size()), '0') + symbol;
+            if (indexOf(symbolTable().find(symbol)) != -1) continue;
+            double price = 10.0 + (mixBits((uint32_t)i) % 99000) / 100.0;
+            addStock(symbol, price, 1000 + (int)(mixBits((uint32_t)i + 1) % 9000));
+        }
+    }
+
+    void setSeed(uint64_t seed) { engine.setSeed(seed); }
+
+    // Prices depend only on (seed, symbol, tick), so any thread count gives identical results
+    void setThreads(size_t threads) {
+        workerPool.reset(threads > 1 ? new WorkerPool(threads) : nullptr);
+    }
+
+    size_t getThreads() const { return workerPool ? workerPool->threadCount() : 1; }
+    size_t size() const { return stocks.size(); }
+
+    Stock& getStockAt(size_t index) { return stocks[index]; }
+
+    double getVolatility(SymbolId id) const {
+        int index = indexOf(id);
+        if (index == -1) {
+            throw runtime_error("Stock not found");
+        }
+        return engine.getVolatility(index);
+    }
+
+    Stock& getStock(SymbolId id) {
+        int index = indexOf(id);
+        if (index == -1) {
+            throw runtime_error("Stock not found");
+        }
+        return stocks[index];
+    }
+
+    Stock& getStock(const string& symbol) {
+        return getStock(symbolTable().find(symbol));
+    }
+
+    void updateMarket() {
+        ScopedLatency latency(Metric::Tick);
+        const long long tick = engine.getTick();
+        auto advanceChunk = [&](size_t begin, size_t end) {
+            engine.advanceRange(begin, end, tick);
+            for (size_t index = begin; index < end; ++index) {
+                Stock& stock = stocks[index];
+                stock.applyPrice(engine.getPrice(index));
+                engine.setShares(index, stock.getAvailableShares());
+            }
+        };
+
+        if (workerPool) {
+            workerPool->parallelFor(stocks.size(), 4096, advanceChunk);
+        } else {
+            advanceChunk(0, stocks.size());
+        }
+        engine.finishTick();
+
+        // Shared structures are merged after the per-symbol phase
+        for (const Stock& stock : stocks) {
+            topStocks.update(stock.getId(), rankValue(stock));
+        }
+        if (correlations) {
+            correlations->onTick(engine.priceData(), workerPool.get());
+        }
+    }
+
+    void displayMarketStatus() const {
+        cout << "\n=== Market Status ===\n";
+        vector<SymbolId> symbols;
+        for (const Stock& stock : stocks) {
+            symbols.push_back(stock.getId());
+        }
+        sortByName(symbols);
+        for (SymbolId symbol : symbols) {
+            cout << symbolTable().name(symbol) << ": $" << fixed << setprecision(2)
+                 << stocks[indexOf(symbol)].getCurrentPrice() << "\n";
+        }
+    }
+
+    void displayMarketNews() const {
+        cout << "\n=== Market News ===\n";
+        cout << "No news available.\n";
+    }
+
+    void searchStock(const string& symbol) {
+        int index = indexOf(symbolTable().find(symbol));
+        if (index != -1) {
+            cout << "Stock found: " << symbol << " - $" << stocks[index].getCurrentPrice() << "\n";
+            return;
+        }
+        cout << "Stock not found: " << symbol << "\n";
+        vector<SymbolIndex::Match> suggestions = searchFuzzy(symbol, 3, 2, RankKey::Price);
+        if (!suggestions.empty()) {
+            cout << "Did you mean:";
+            for (const SymbolIndex::Match& match : suggestions) cout << " " << symbolTable().name(match.symbol);
+            cout << "\n";
+        }
+    }
+
+    const SymbolIndex& getSearchIndex() {
+        if (searchIndexStale) {
+            vector<SymbolId> listed;
+            listed.reserve(stocks.size());
+            for (const Stock& stock : stocks) listed.push_back(stock.getId());
+            searchIndex.build(listed);
+            searchIndexStale = false;
+        }
+        return searchIndex;
+    }
+
+    // Up to `k` listed symbols starting with `prefix`: alphabetical, or by `key` when `ranked`
+    vector<SymbolIndex::Match> searchPrefix(const string& prefix, size_t k, RankKey key, bool ranked) {
+        return getSearchIndex().prefix(prefix, k, [&](SymbolId id) { return rankValue(stocks[indexOf(id)], key); }, ranked);
+    }
+
+    // The `k` closest listed symbols within `maxDistance` edits, ties broken by `key`
+    vector<SymbolIndex::Match> searchFuzzy(const string& query, size_t k, int maxDistance, RankKey key) {
+        return getSearchIndex().fuzzy(query, k, maxDistance, [&](SymbolId id) { return rankValue(stocks[indexOf(id)], key); });
+    }
+
+    void displaySearchResults(const string& title, const vector<SymbolIndex::Match>& matches, double seconds) const {
+        cout << "\n=== " << title << ": " << matches.size() << " matches in " << fixed << setprecision(1)
+             << seconds * 1e6 << " us ===\n";
+        cout << left << setw(12) << "Symbol" << right << setw(6) << "Edits" << setw(12) << "Price"
+             << setw(10) << "Change %" << setw(12) << "Volume" << "\n";
+        for (const SymbolIndex::Match& match : matches) {
+            const Stock& stock = stocks[indexOf(match.symbol)];
+            cout << left << setw(12) << stock.getSymbol() << right << setw(6) << match.distance << setprecision(2)
+                 << setw(12) << stock.getCurrentPrice() << setw(10) << rankValue(stock, RankKey::PercentChange)
+                 << setw(12) << stock.getVolume() << "\n";
+        }
+    }
+
+    // Applies an externally sourced price (replay, feeds); unlisted symbols are listed on first sight
+    // False, changing nothing, for a price that is not positive and finite
+    // or a tick without a symbol
+    bool applyTick(SymbolId id, double price) {
+        if (id == INVALID_SYMBOL || !(price > 0.0 && isfinite(price))) return false;
+        int index = indexOf(id);
+        if (index == -1) {
+            addStock(symbolTable().name(id), price, 1000);
+            return true;
+        }
+        Stock& stock = stocks[index];
+        stock.applyPrice(price);
+        engine.setPrice(index, price);
+        topStocks.update(id, rankValue(stock));
+        return true;
+    }
+
+    // Re-keys every entry when the ranking changes
+    void setRankKey(RankKey key) {
+        rankKey = key;
+        for (const Stock& stock : stocks) {
+            topStocks.update(stock.getId(), rankValue(stock));
+        }
+    }
+
+    // Top N by `key` without printing (server and other API callers)
+    vector<pair<SymbolId, double>> topStocksBy(int N, RankKey key) {
+        if (key != rankKey || key == RankKey::Volume) {
+            setRankKey(key);
+        }
+        return topStocks.topN(N);
+    }
+
+    // Volume from portfolio trades since the last tick is picked up here
+    void displayTopStocks(int N) {
+        ScopedLatency latency(Metric::TopN);
+        if (rankKey == RankKey::Volume) {
+            setRankKey(rankKey);
+        }
+        topStocks.displayTopN(N, rankKey);
+    }
+
+    void addStockRelationship(const string& stock1, const string& stock2, double weight = 1.0) {
+        stockGraph.addEdge(symbolTable().intern(stock1), symbolTable().intern(stock2), weight);
+    }
+
+    void displayStockRelationships() const {
+        stockGraph.displayRelationships();
+    }
+
+    Graph& getGraph() { return stockGraph; }
+    WorkerPool* getWorkerPool() { return workerPool.get(); }
+
+    // Starts rolling correlations over the first `maxStocks` listed stocks (0 = all)
+    void trackCorrelations(size_t window, size_t maxStocks = 0) {
+        size_t n = maxStocks == 0 ? stocks.size() : min(maxStocks, stocks.size());
+        if (n > CorrelationEngine::MAX_MEMBERS) {
+            throw runtime_error("Correlations track at most " + to_string(CorrelationEngine::MAX_MEMBERS) +
+                                " stocks; " + to_string(n) + " are listed, so pass a smaller MAXSTOCKS");
+        }
+        if (max<size_t>(window, 2) * n > CorrelationEngine::MAX_RETURNS) {
+            throw runtime_error("Correlation window is too long for " + to_string(n) + " stocks");
+        }
+        vector<size_t> members(n);
+        for (size_t i = 0; i < n; ++i) members[i] = i;
+        correlations.reset(new CorrelationEngine(members, window));
+    }
+
+    const CorrelationEngine& getCorrelations() const {
+        if (!correlations) throw runtime_error("Correlation tracking is off");
+        return *correlations;
+    }
+
+    double correlation(const string& stock1, const string& stock2) const {
+        const CorrelationEngine& engineRef = getCorrelations();
+        int a = engineRef.find(indexOf(symbolTable().find(stock1)));
+        int b = engineRef.find(indexOf(symbolTable().find(stock2)));
+        if (a < 0 || b < 0) throw runtime_error("Stock is not tracked for correlations");
+        return engineRef.correlation(a, b);
+    }
+
+    // Adds an edge weighted by |correlation| for every tracked pair at or above threshold
+    size_t linkCorrelated(double threshold) {
+        const CorrelationEngine& tracked = getCorrelations();
+        size_t added = 0;
+        for (size_t a = 0; a < tracked.size(); ++a) {
+            for (size_t b = a + 1; b < tracked.size(); ++b) {
+                double rho = fabs(tracked.correlation(a, b));
+                if (rho >= threshold) {
+                    stockGraph.setEdge(stocks[tracked.memberIndex(a)].getId(), stocks[tracked.memberIndex(b)].getId(), rho);
+                    added++;
+                }
+            }
+        }
+        return added;
+    }
+
+    // Adds `count` random relationships between listed stocks (for scale runs)
+    void generateRelationships(long long count) {
+        if (stocks.size() < 2) return;
+        for (long long i = 0; i < count; ++i) {
+            uint32_t a = mixBits((uint32_t)i * 2 + 0x51ed27U) % stocks.size();
+            uint32_t b = mixBits((uint32_t)i * 2 + 0x51ed28U) % stocks.size();
+            stockGraph.addEdge(stocks[a].getId(), stocks[b].getId());
+        }
+    }
+
+    void save(SnapshotWriter& out) const {
+        out.put<uint64_t>(engine.getSeed());
+        out.put<int64_t>(engine.getTick());
+        out.put<int32_t>((int32_t)rankKey);
+        out.put<uint64_t>(stocks.size());
+        for (size_t index = 0; index < stocks.size(); ++index) {
+            stocks[index].save(out);
+            out.put<double>(engine.getVolatility(index));
+        }
+        stockGraph.save(out);
+    }
+
+    // A fully decoded snapshot of the market, waiting for install()
+    struct Restored {
+        uint64_t seed;
+        int64_t tick;
+        RankKey key;
+        vector<Stock> stocks;
+        vector<double> volatilities;  // by stock index
+        vector<int> index;            // SymbolId -> stock index, or -1
+        Graph graph;
+
+        bool lists(SymbolId symbol) const { return symbol < index.size() && index[symbol] != -1; }
+    };
+
+    // Reads every listed stock, the engine state and the relationship graph
+    // without touching the live market, so a bad snapshot changes nothing
+    static Restored decode(SnapshotReader& in) {
+        Restored staged;
+        staged.seed = in.get<uint64_t>();
+        staged.tick = in.get<int64_t>();
+        staged.key = (RankKey)in.get<int32_t>();
+        uint64_t n = in.getCount(sizeof(uint32_t) + 3 * sizeof(double) + sizeof(int32_t) + sizeof(int64_t));
+        staged.stocks.reserve(n);
+        staged.volatilities.reserve(n);
+        for (uint64_t i = 0; i < n; ++i) {
+            staged.stocks.emplace_back();
+            Stock& stock = staged.stocks.back();
+            stock.restore(in);
+            staged.volatilities.push_back(in.get<double>());
+            if (stock.getId() == INVALID_SYMBOL || staged.lists(stock.getId())) {
+                throw runtime_error("Snapshot lists a stock twice or without a symbol");
+            }
+            if (stock.getId() >= staged.index.size()) {
+                staged.index.resize(stock.getId() + 1, -1);
+            }
+            staged.index[stock.getId()] = (int)i;
+        }
+        staged.graph.restore(in);
+        return staged;
+    }
+
+    // Replaces every listed stock, the engine state and the relationship graph;
+    // correlation tracking indexed the old listing, so it is switched off
+    void install(Restored& staged) {
+        correlations.reset();
+        stocks.swap(staged.stocks);
+        marketIndex.swap(staged.index);
+        stockGraph = move(staged.graph);
+        historyArena.reset();
+        engine.clear();
+        engine.setSeed(staged.seed);
+        engine.setTick(staged.tick);
+        topStocks.clear();
+        for (size_t i = 0; i < stocks.size(); ++i) {
+            Stock& stock = stocks[i];
+            if (compressHistory) {
+                stock.getHistory().setCompressedTier(historyCompression);
+            }
+            bindHistory(stock);
+            engine.addSymbol(stock.getCurrentPrice(), stock.getAvailableShares(), staged.volatilities[i]);
+        }
+        searchIndexStale = true;
+        setRankKey(staged.key);
+    }
+
+    // Applies ring capacity, query window and an optional spill directory to every
+    // stock (and to stocks listed later); `preallocate` backs every ring from the arena
+    void configureHistory(size_t capacity, size_t window, const string& spillDirectory = "",
+                          bool preallocate = false) {
+        if (capacity < 1 || window < 1) throw runtime_error("History capacity and window must be at least 1");
+        historyCapacity = capacity;
+        historyWindow = window;
+        preallocateHistory = preallocate;
+        for (Stock& stock : stocks) {
+            PriceHistory& history = stock.getHistory();
+            history.setCapacity(capacity);
+            history.setWindow(window);
+            history.setEmaPeriod((int)window);
+            if (!spillDirectory.empty()) {
+                history.setSpillFile(spillDirectory + "/" + stock.getSymbol() + ".hist");
+            }
+        }
+        if (!spillDirectory.empty()) {
+            compressHistory = false;
+        }
+
+        // setCapacity moved every ring to its own storage, so the arena can be recycled
+        historyArena.reset();
+        for (Stock& stock : stocks) {
+            bindHistory(stock);
+        }
+    }
+
+    size_t historyArenaBytes() const { return historyArena.bytesReserved(); }
+
+    // Evicted prices of every stock (and stocks listed later) go to a fresh
+    // in-memory compressed tier; prices spilled so far are dropped
+    void compressHistories(CompressedPrices::Mode mode) {
+        compressHistory = true;
+        historyCompression = mode;
+        for (Stock& stock : stocks) {
+            stock.getHistory().setCompressedTier(mode);
+        }
+    }
+
+    void displayHistoryMemory() const {
+        size_t ringBytes = 0, tierBytes = 0;
+        long long retained = 0, spilled = 0;
+        for (const Stock& stock : stocks) {
+            const PriceHistory& history = stock.getHistory();
+            ringBytes += history.ringBytes();
+            tierBytes += history.compressedBytes();
+            retained += (long long)history.size();
+            spilled += history.spilledTicks();
+        }
+        cout << "\n=== History Memory: " << stocks.size() << " stocks ===\n";
+        cout << fixed << setprecision(2);
+        cout << "Ring:       " << setw(12) << retained << " prices, " << setw(10) << ringBytes / 1048576.0 << " MB";
+        if (retained > 0) cout << "  (" << (double)ringBytes / retained << " bytes/price)";
+        cout << "\n";
+        cout << "Spill tier: " << setw(12) << spilled << " prices, " << setw(10) << tierBytes / 1048576.0 << " MB";
+        if (!compressHistory) {
+            cout << "  (" << (spilled > 0 ? "raw file" : "none") << ")\n";
+        } else if (spilled > 0) {
+            cout << "  (" << 8.0 * tierBytes / spilled << " bits/price, "
+                 << (historyCompression == CompressedPrices::Mode::Lossless ? "lossless" : "cents") << ", "
+                 << 2 * sizeof(double) * (double)spilled / max<size_t>(tierBytes, 1) << "x smaller than the ring)\n";
+        } else {
+            cout << "\n";
+        }
+    }
+};
+
+// Mark-to-Market Valuation
+// Keeps the market value of every portfolio current without walking every
+// portfolio. An inverted index lists, per SymbolId, the portfolios holding it
+// with their share counts; revalue() compares each held symbol's price with
+// the price it was last valued at and adds shares x change to each holder, so
+// the work is proportional to held positions whose price moved. Portfolios are
+// identified by the dense slot number PortfolioManager assigns them.
+class ValuationIndex {
+private:
+    struct Holder {
+        uint32_t slot;
+        int32_t shares;
+    };
+
+    vector<vector<Holder>> holders;   // per SymbolId
+    vector<double> valuedAt;          // per SymbolId, price reflected in marketValue
+    vector<SymbolId> heldSymbols;     // symbols that have (or recently had) holders
+    vector<uint8_t> inHeldList;       // per SymbolId
+    vector<double> marketValue;       // per slot
+
+public:
+    void clear() {
+        holders.clear();
+        valuedAt.clear();
+        heldSymbols.clear();
+        inHeldList.clear();
+        marketValue.clear();
+    }
+
+    void addSlot() { marketValue.push_back(0.0); }
+    size_t slots() const { return marketValue.size(); }
+    double value(size_t slot) const { return marketValue[slot]; }
+
+    // Sets a portfolio's share count in a symbol. The change is valued at the
+    // symbol's last valuation price (`price` for a symbol nobody held), so the
+    // next revalue() brings it to market like every other position.
+    void setPosition(uint32_t slot, SymbolId symbol, int shares, double price) {
+        if (symbol >= holders.size()) {
+            holders.resize(symbol + 1);
+            valuedAt.resize(symbol + 1, 0.0);
+            inHeldList.resize(symbol + 1, 0);
+        }
+        vector<Holder>& list = holders[symbol];
+        if (list.empty()) {
+            valuedAt[symbol] = price;
+        }
+        if (!inHeldList[symbol]) {
+            inHeldList[symbol] = 1;
+            heldSymbols.push_back(symbol);
+        }
+
+        // Holder lists are short relative to trade rates; a scan beats keeping back-pointers
+        auto it = find_if(list.begin(), list.end(), [slot](const Holder& holder) { return holder.slot == slot; });
+        int previous = it != list.end() ? it->shares : 0;
+        marketValue[slot] += (shares - previous) * valuedAt[symbol];
+        if (shares <= 0) {
+            if (it != list.end()) {
+                *it = list.back();
+                list.pop_back();
+            }
+        } else if (it != list.end()) {
+            it->shares = shares;
+        } else {
+            list.push_back(Holder{slot, shares});
+        }
+    }
+
+    // Applies price changes since the last call; returns the positions touched
+    size_t revalue(StockMarket& market) {
+        size_t touched = 0;
+        size_t kept = 0;
+        for (SymbolId symbol : heldSymbols) {
+            const vector<Holder>& list = holders[symbol];
+            if (list.empty()) {
+                inHeldList[symbol] = 0;
+                continue;
+            }
+            heldSymbols[kept++] = symbol;
+            double price = market.getStock(symbol).getCurrentPrice();
+            double change = price - valuedAt[symbol];
+            if (change == 0.0) continue;
+            valuedAt[symbol] = price;
+            for (const Holder& holder : list) {
+                marketValue[holder.slot] += holder.shares * change;
+            }
+            touched += list.size();
+        }
+        heldSymbols.resize(kept);
+        return touched;
+    }
+
+    // Replaces the incremental values with `fresh` (after a full revalue)
+    void resync(const vector<double>& fresh, StockMarket& market) {
+        marketValue = fresh;
+        for (SymbolId symbol : heldSymbols) {
+            if (!holders[symbol].empty()) {
+                valuedAt[symbol] = market.getStock(symbol).getCurrentPrice();
+            }
+        }
+    }
+};
+
+// PortfolioManager Class
+// Portfolios live in SHARD_COUNT shards picked by a hash of the name. Each
+// shard has its own lock, name index, storage and ValuationIndex, so client
+// threads trading different portfolios rarely contend and no lock is global.
+// A PortfolioHandle (shard, slot) names a portfolio without a name lookup.
+struct PortfolioHandle {
+    uint32_t shard;
+    uint32_t slot;
+};
+
+class PortfolioManager {
+private:
+    static constexpr size_t SHARD_COUNT = 64;
+
+    struct Shard {
+        mutable mutex lock;
+        unordered_map<string, uint32_t> slotByName;
+        deque<Portfolio> portfolios;   // indexed by slot; deque keeps references valid as it grows
+        vector<string> names;          // by slot
+        ValuationIndex valuation;
+    };
+
+    struct Entry {
+        const string* name;
+        PortfolioHandle handle;
+    };
+
+    unique_ptr<Shard[]> shards;
+    atomic<size_t> portfolioCount;
+    string currentPortfolioName;
+    PortfolioHandle current;
+    string journalDirectory;
+
+    static uint32_t shardOf(const string& name) {
+        return (uint32_t)(hash<string>{}(name) % SHARD_COUNT);
+    }
+
+    // Caller holds the shard lock
+    uint32_t addPortfolio(Shard& shard, const string& name, double initialCash) {
+        uint32_t slot = shard.portfolios.size();
+        shard.portfolios.emplace_back(initialCash);
+        shard.names.push_back(name);
+        shard.slotByName.emplace(name, slot);
+        shard.valuation.addSlot();
+        portfolioCount++;
+        return slot;
+    }
+
+    // Caller holds the shard lock
+    void reindex(Shard& shard, uint32_t slot, const Stock& stock) {
+        shard.valuation.setPosition(slot, stock.getId(), shard.portfolios[slot].holdings(stock.getId()),
+                                    stock.getCurrentPrice());
+    }
+
+    // Every portfolio, sorted by name (single-threaded views, or under lockShards())
+    vector<Entry> sortedEntries() const {
+        vector<Entry> entries;
+        for (uint32_t s = 0; s < SHARD_COUNT; ++s) {
+            for (uint32_t slot = 0; slot < shards[s].names.size(); ++slot) {
+                entries.push_back(Entry{&shards[s].names[slot], PortfolioHandle{s, slot}});
+            }
+        }
+        sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return *a.name < *b.name; });
+        return entries;
+    }
+
+public:
+    PortfolioManager() : shards(new Shard[SHARD_COUNT]), portfolioCount(0), current{0, 0} {}
+
+    // New portfolios journal to <directory>/<name>.journal; empty keeps journals in memory
+    void setJournalDirectory(const string& directory) {
+        journalDirectory = directory;
+    }
+
+    void createPortfolio(const string& name, double initialCash = 10000.0, bool quiet = false) {
+        Shard& shard = shards[shardOf(name)];
+        {
+            lock_guard<mutex> guard(shard.lock);
+            if (shard.slotByName.find(name) == shard.slotByName.end()) {
+                // Open the journal first, so a file that cannot be opened adds no portfolio
+                TradeJournal journal;
+                if (!journalDirectory.empty()) {
+                    journal.open(journalDirectory + "/" + name + ".journal");
+                }
+                uint32_t slot = addPortfolio(shard, name, initialCash);
+                shard.portfolios[slot].getJournal().swap(journal);
+            }
+        }
+        if (!quiet) cout << "Portfolio '" << name << "' created.\n";
+    }
+
+    PortfolioHandle find(const string& name) const {
+        uint32_t s = shardOf(name);
+        lock_guard<mutex> guard(shards[s].lock);
+        auto it = shards[s].slotByName.find(name);
+        if (it == shards[s].slotByName.end()) {
+            throw runtime_error("Portfolio not found");
+        }
+        return PortfolioHandle{s, it->second};
+    }
+
+    void selectPortfolio(const string& name) {
+        current = find(name);
+        currentPortfolioName = name;
+        cout << "Selected portfolio: " << name << "\n";
+    }
+
+    Portfolio& getCurrentPortfolio() {
+        if (currentPortfolioName.empty()) {
+            throw runtime_error("No portfolio selected");
+        }
+        return shards[current.shard].portfolios[current.slot];
+    }
+
+    double cashOf(PortfolioHandle handle) const {
+        lock_guard<mutex> guard(shards[handle.shard].lock);
+        return shards[handle.shard].portfolios[handle.slot].getCash();
+    }
+
+    // Trades go through the manager so the valuation index sees every position change
+    void buyStock(PortfolioHandle handle, Stock& stock, int shares) {
+        if (shares <= 0) throw runtime_error("Share count must be positive");
+        Shard& shard = shards[handle.shard];
+        lock_guard<mutex> guard(shard.lock);
+        shard.portfolios[handle.slot].buyStock(stock, shares);
+        reindex(shard, handle.slot, stock);
+    }
+
+    void sellStock(PortfolioHandle handle, Stock& stock, int shares) {
+        if (shares <= 0) throw runtime_error("Share count must be positive");
+        Shard& shard = shards[handle.shard];
+        lock_guard<mutex> guard(shard.lock);
+        shard.portfolios[handle.slot].sellStock(stock, shares);
+        reindex(shard, handle.slot, stock);
+    }
+
+    void buyStock(Stock& stock, int shares) {
+        getCurrentPortfolio();
+        buyStock(current, stock, shares);
+    }
+
+    void sellStock(Stock& stock, int shares) {
+        getCurrentPortfolio();
+        sellStock(current, stock, shares);
+    }
+
+    // Non-throwing trade for client threads; false when the portfolio or the
+    // stock cannot cover it (checked up front, so exceptions stay rare)
+    bool tryTrade(PortfolioHandle handle, Stock& stock, bool buy, int shares) {
+        if (shares <= 0) return false;
+        Shard& shard = shards[handle.shard];
+        lock_guard<mutex> guard(shard.lock);
+        Portfolio& portfolio = shard.portfolios[handle.slot];
+        bool covered = buy ? shares * stock.getCurrentPrice() <= portfolio.getCash() && shares <= stock.getAvailableShares()
+                           : portfolio.holdings(stock.getId()) >= shares;
+        if (!covered) return false;
+        try {
+            if (buy) portfolio.buyStock(stock, shares);
+            else portfolio.sellStock(stock, shares);
+        } catch (const runtime_error&) {
+            return false;  // another client took the last shares, or a tick moved the price
+        }
+        reindex(shard, handle.slot, stock);
+        return true;
+    }
+
+    void displayPortfolios() const {
+        cout << "\n=== Available Portfolios ===\n";
+        for (const Entry& entry : sortedEntries()) {
+            cout << *entry.name << "\n";
+        }
+    }
+
+    bool hasPortfolios() const {
+        return portfolioCount > 0;
+    }
+
+    // Every portfolio with its name, sorted by name (not while clients are trading,
+    // unless the caller holds lockShards())
+    vector<pair<const string*, const Portfolio*>> listPortfolios() const {
+        vector<pair<const string*, const Portfolio*>> list;
+        for (const Entry& entry : sortedEntries()) {
+            list.emplace_back(entry.name, &shards[entry.handle.shard].portfolios[entry.handle.slot]);
+        }
+        return list;
+    }
+
+    size_t size() const { return portfolioCount; }
+
+    // Adds every portfolio's shares into heldShares[SymbolId]
+    void addHeldShares(vector<long long>& heldShares) const {
+        for (size_t s = 0; s < SHARD_COUNT; ++s) {
+            lock_guard<mutex> guard(shards[s].lock);
+            for (const Portfolio& portfolio : shards[s].portfolios) {
+                for (const auto& position : portfolio.getHoldings()) {
+                    if (position.symbol >= heldShares.size()) heldShares.resize(position.symbol + 1, 0);
+                    heldShares[position.symbol] += position.shares;
+                }
+            }
+        }
+    }
+
+    // Brings every portfolio's market value up to date, one shard per task; call after prices move
+    size_t revalue(StockMarket& market) {
+        atomic<size_t> touched(0);
+        auto work = [&](size_t begin, size_t end) {
+            for (size_t s = begin; s < end; ++s) {
+                lock_guard<mutex> guard(shards[s].lock);
+                touched += shards[s].valuation.revalue(market);
+            }
+        };
+        runParallel(market.getWorkerPool(), SHARD_COUNT, 1, work);
+        return touched;
+    }
+
+    // Recomputes every market value from holdings in parallel and compares it
+    // with the incremental value; returns the largest absolute difference.
+    // With `resync` the recomputed values replace the incremental ones.
+    double fullRevalue(StockMarket& market, bool resync = false) {
+        vector<double> worst(SHARD_COUNT, 0.0);
+        auto work = [&](size_t begin, size_t end) {
+            for (size_t s = begin; s < end; ++s) {
+                Shard& shard = shards[s];
+                lock_guard<mutex> guard(shard.lock);
+                shard.valuation.revalue(market);
+                vector<double> fresh(shard.portfolios.size(), 0.0);
+                for (size_t slot = 0; slot < fresh.size(); ++slot) {
+                    for (const auto& position : shard.portfolios[slot].getHoldings()) {
+                        fresh[slot] += position.shares * market.getStock(position.symbol).getCurrentPrice();
+                    }
+                    worst[s] = max(worst[s], fabs(fresh[slot] - shard.valuation.value(slot)));
+                }
+                if (resync) shard.valuation.resync(fresh, market);
+            }
+        };
+        runParallel(market.getWorkerPool(), SHARD_COUNT, 1, work);
+        return *max_element(worst.begin(), worst.end());
+    }
+
+    // Creates `count` portfolios holding `positions` random listed stocks each (for scale runs)
+    void generatePortfolios(StockMarket& market, int count, int positions, uint64_t seed = 1) {
+        if (market.size() == 0) throw runtime_error("No stocks listed");
+        uint32_t state = (uint32_t)seed;
+        for (int i = 0; i < count; ++i) {
+            string name = "PF" + to_string(portfolioCount.load());
+            createPortfolio(name, 1e8, true);
+            PortfolioHandle handle = find(name);
+            for (int p = 0; p < positions; ++p) {
+                uint32_t draw = mixBits(state += 0x9E3779B9U);
+                buyStock(handle, market.getStockAt(draw % market.size()), 1 + (int)(mixBits(draw) % 100));
+            }
+        }
+    }
+
+    // Market value, cost basis and P&L for the first `limit` portfolios by name, then totals
+    void displayValuations(size_t limit) const {
+        cout << "\n=== Portfolio Valuations ===\n";
+        cout << left << setw(14) << "Portfolio" << right << setw(18) << "Market Value" << setw(18) << "Unrealized"
+             << setw(18) << "Realized" << setw(18) << "Equity" << "\n";
+        double totalValue = 0, totalUnrealized = 0, totalRealized = 0, totalEquity = 0;
+        size_t shown = 0;
+        cout << fixed << setprecision(2);
+        for (const Entry& entry : sortedEntries()) {
+            const Shard& shard = shards[entry.handle.shard];
+            const Portfolio& portfolio = shard.portfolios[entry.handle.slot];
+            double value = shard.valuation.value(entry.handle.slot);
+            double unrealized = value - portfolio.getCostBasis();
+            double equity = portfolio.getCash() + value;
+            totalValue += value;
+            totalUnrealized += unrealized;
+            totalRealized += portfolio.getRealizedPnL();
+            totalEquity += equity;
+            if (shown++ < limit) {
+                cout << left << setw(14) << *entry.name << right << setw(18) << value << setw(18) << unrealized
+                     << setw(18) << portfolio.getRealizedPnL() << setw(18) << equity << "\n";
+            }
+        }
+        cout << left << setw(14) << "TOTAL" << right << setw(18) << totalValue << setw(18) << totalUnrealized
+             << setw(18) << totalRealized << setw(18) << totalEquity << "\n";
+        cout << left;
+    }
+
+    // Every shard's lock, taken in shard order; held, the portfolios cannot change
+    vector<unique_lock<mutex>> lockShards() const {
+        vector<unique_lock<mutex>> locks;
+        locks.reserve(SHARD_COUNT);
+        for (uint32_t s = 0; s < SHARD_COUNT; ++s) locks.emplace_back(shards[s].lock);
+        return locks;
+    }
+
+    // Caller holds lockShards(), so trading clients see a consistent cut
+    void save(SnapshotWriter& out) const {
+        out.put<uint64_t>(portfolioCount.load());
+        for (const Entry& entry : sortedEntries()) {
+            out.putString(*entry.name);
+            shards[entry.handle.shard].portfolios[entry.handle.slot].save(out);
+        }
+        out.putString(currentPortfolioName);
+    }
+
+    // Fully decoded portfolios, waiting for install()
+    struct Restored {
+        unique_ptr<Shard[]> shards;
+        size_t count = 0;
+        string currentName;
+    };
+
+    // Reads every portfolio into fresh shards without touching the live ones;
+    // each holding must be a stock the staged market lists
+    static Restored decode(SnapshotReader& in, const StockMarket::Restored& market) {
+        Restored staged;
+        staged.shards.reset(new Shard[SHARD_COUNT]);
+        uint64_t n = in.getCount(sizeof(uint32_t) + 4 * sizeof(double));
+        for (uint64_t i = 0; i < n; ++i) {
+            string name = in.getString();
+            Shard& shard = staged.shards[shardOf(name)];
+            if (!shard.slotByName.emplace(name, (uint32_t)shard.portfolios.size()).second) {
+                throw runtime_error("Snapshot lists portfolio " + name + " twice");
+            }
+            shard.portfolios.emplace_back(0.0);
+            shard.names.push_back(name);
+            shard.valuation.addSlot();
+            shard.portfolios.back().restore(in);
+            for (const auto& position : shard.portfolios.back().getHoldings()) {
+                if (!market.lists(position.symbol)) {
+                    throw runtime_error("Snapshot holds an unlisted stock");
+                }
+            }
+            staged.count++;
+        }
+        staged.currentName = in.getString();
+        return staged;
+    }
+
+    // Restored journals are kept in memory; valuations are rebuilt from holdings
+    void install(Restored& staged, StockMarket& market) {
+        shards.swap(staged.shards);
+        portfolioCount = staged.count;
+        currentPortfolioName = move(staged.currentName);
+        for (uint32_t s = 0; s < SHARD_COUNT; ++s) {
+            Shard& shard = shards[s];
+            for (uint32_t slot = 0; slot < shard.portfolios.size(); ++slot) {
+                for (const auto& position : shard.portfolios[slot].getHoldings()) {
+                    reindex(shard, slot, market.getStock(position.symbol));
+                }
+            }
+        }
+        current = PortfolioHandle{0, 0};
+        if (!currentPortfolioName.empty()) current = find(currentPortfolioName);
+    }
+};
+
+// Concurrent Trading Stress Test
+// `clients` threads each trade their own portfolio (random buys and sells of
+// random listed stocks) while the calling thread keeps ticking the market and
+// revaluing. Afterwards every stock's available shares plus the shares held
+// across all portfolios must equal the total before the run.
+class StressTest {
+public:
+    struct Result {
+        long long operations;
+        long long trades;
+        long long ticks;
+        double seconds;
+        bool conserved;
+    };
+
+    static Result run(StockMarket& market, PortfolioManager& portfolioManager, int clients, int operationsPerClient) {
+        if (market.size() == 0) throw runtime_error("No stocks listed");
+        vector<PortfolioHandle> handles;
+        for (int c = 0; c < clients; ++c) {
+            string name = "client" + to_string(c);
+            portfolioManager.createPortfolio(name, 1e7, true);
+            handles.push_back(portfolioManager.find(name));
+        }
+        vector<long long> before = shareTotals(market, portfolioManager);
+
+        atomic<int> running(clients);
+        atomic<long long> trades(0);
+        auto client = [&](int c) {
+            uint32_t state = mixBits((uint32_t)c + 1);
+            long long done = 0;
+            for (int op = 0; op < operationsPerClient; ++op) {
+                uint32_t draw = mixBits(state += 0x9E3779B9U);
+                uint32_t detail = mixBits(draw);
+                Stock& stock = market.getStockAt(draw % market.size());
+                bool buy = detail % 3 != 0;  // buy-biased so sells find holdings
+                if (portfolioManager.tryTrade(handles[c], stock, buy, 1 + (int)((detail >> 8) % 10))) done++;
+            }
+            trades += done;
+            running--;
+        };
+
+        auto start = chrono::steady_clock::now();
+        vector<thread> threads;
+        for (int c = 0; c < clients; ++c) {
+            threads.emplace_back(client, c);
+        }
+        long long ticks = 0;
+        while (running > 0) {
+            market.updateMarket();
+            portfolioManager.revalue(market);
+            ticks++;
+        }
+        for (thread& t : threads) t.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        return Result{(long long)clients * operationsPerClient, trades, ticks, seconds,
+                      shareTotals(market, portfolioManager) == before};
+    }
+
+private:
+    // Available plus held shares per listed stock, by market index
+    static vector<long long> shareTotals(StockMarket& market, const PortfolioManager& portfolioManager) {
+        vector<long long> held;
+        portfolioManager.addHeldShares(held);
+        vector<long long> totals(market.size());
+        for (size_t i = 0; i < market.size(); ++i) {
+            const Stock& stock = market.getStockAt(i);
+            totals[i] = stock.getAvailableShares() + (stock.getId() < held.size() ? held[stock.getId()] : 0);
+        }
+        return totals;
+    }
+};
+
+// Monte Carlo Value-at-Risk
+// Projects a portfolio's holdings forward with the market's own random walk
+// (uniform steps of up to +/-2.00 x volatility, floored at 0.01) and returns
+// the distribution of losses at the horizon. Each path's draws come from the
+// counter-based generator keyed on (seed, path, step) with the position as
+// the stream, so results are identical for any thread count. Paths are split
+// across the WorkerPool; the per-step kernel is a straight loop over
+// contiguous position arrays that vectorizes like TickEngine::advanceRange.
+class RiskEngine {
+public:
+    struct Result {
+        vector<double> losses;  // sorted ascending; loss = value today - value at horizon
+        double initialValue;
+        double seconds;
+
+        // Loss not exceeded with the given confidence (e.g. 0.99)
+        double valueAtRisk(double confidence) const {
+            if (losses.empty()) return 0.0;
+            size_t index = min(losses.size() - 1, (size_t)ceil(confidence * losses.size()) - 1);
+            return losses[index];
+        }
+
+        // Mean loss in the tail beyond the VaR
+        double conditionalValueAtRisk(double confidence) const {
+            if (losses.empty()) return 0.0;
+            size_t first = min(losses.size() - 1, (size_t)ceil(confidence * losses.size()) - 1);
+            double sum = 0.0;
+            for (size_t i = first; i < losses.size(); ++i) sum += losses[i];
+            return sum / (losses.size() - first);
+        }
+    };
+
+    static Result simulate(const Portfolio& portfolio, StockMarket& market, size_t paths, int horizon,
+                           uint64_t seed = 1) {
+        auto start = chrono::steady_clock::now();
+        vector<double> prices, shares, volatility;
+        double initialValue = 0.0;
+        for (const auto& position : portfolio.getHoldings()) {
+            prices.push_back(market.getStock(position.symbol).getCurrentPrice());
+            shares.push_back(position.shares);
+            volatility.push_back(market.getVolatility(position.symbol));
+            initialValue += prices.back() * shares.back();
+        }
+        const size_t n = prices.size();
+
+        Result result{vector<double>(paths, 0.0), initialValue, 0.0};
+        auto work = [&](size_t begin, size_t end) {
+            vector<double> scratch(n);
+            double* __restrict price = scratch.data();
+            const double* __restrict vol = volatility.data();
+            const double* __restrict held = shares.data();
+            for (size_t path = begin; path < end; ++path) {
+                copy(prices.begin(), prices.end(), scratch.begin());
+                const uint64_t pathSeed = seed + path * 0x9E3779B97F4A7C15ULL;
+                for (int step = 0; step < horizon; ++step) {
+                    const uint32_t key = tickKey(pathSeed, step);
+                    for (size_t j = 0; j < n; ++j) {
+                        price[j] = max(0.01, price[j] + randomStep(key, (uint32_t)j, vol[j]));
+                    }
+                }
+                double value = 0.0;
+                for (size_t j = 0; j < n; ++j) value += held[j] * price[j];
+                result.losses[path] = initialValue - value;
+            }
+        };
+        runParallel(market.getWorkerPool(), paths, 1024, work);
+
+        sort(result.losses.begin(), result.losses.end());
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return result;
+    }
+
+    static void display(const Result& result, double confidence, int horizon) {
+        const vector<double>& losses = result.losses;
+        double mean = 0.0, squares = 0.0;
+        for (double loss : losses) {
+            mean += loss;
+            squares += loss * loss;
+        }
+        mean /= max<size_t>(losses.size(), 1);
+        double deviation = sqrt(max(0.0, squares / max<size_t>(losses.size(), 1) - mean * mean));
+
+        cout << "\n=== Monte Carlo VaR: " << losses.size() << " paths, " << horizon << " ticks ===\n";
+        cout << fixed << setprecision(2);
+        cout << "Portfolio value: $" << result.initialValue << "\n";
+        cout << "Mean loss: $" << mean << "  Std dev: $" << deviation << "\n";
+        cout << setprecision(1) << "VaR(" << confidence * 100 << "%): $" << setprecision(2)
+             << result.valueAtRisk(confidence) << "  CVaR: $" << result.conditionalValueAtRisk(confidence) << "\n";
+        cout << "Simulated in " << setprecision(3) << result.seconds << " s\n";
+        if (losses.empty() || losses.front() == losses.back()) return;
+
+        // Loss distribution in 20 equal-width bins
+        const int BINS = 20;
+        double low = losses.front(), width = (losses.back() - low) / BINS;
+        vector<size_t> counts(BINS, 0);
+        for (double loss : losses) counts[min(BINS - 1, (int)((loss - low) / width))]++;
+        size_t peak = *max_element(counts.begin(), counts.end());
+        for (int b = 0; b < BINS; ++b) {
+            cout << setprecision(2) << setw(12) << low + b * width << " | " << string(counts[b] * 50 / peak, '#') << "\n";
+        }
+    }
+};
+
+// Strategy Backtesting
+// A PriceTape copies the retained price history of a set of stocks into one
+// read-only, tick-major array (all symbols' prices for tick 0, then tick 1,
+// ...) with running sums for O(1) moving averages. Every backtest run reads
+// the same tape and owns only its strategy state and a BacktestAccount, which
+// applies Portfolio::buyStock/sellStock rules (cash must cover a buy, shares
+// must cover a sell, average-cost basis, realized P&L). Runs are spread over
+// the WorkerPool.
+class PriceTape {
+private:
+    vector<SymbolId> symbols;
+    size_t ticks;
+    vector<double> prices;  // [tick * symbols + s]
+    vector<double> sums;    // [(tick + 1) * symbols + s] = sum of prices up to and including tick
+
+public:
+    // The last `maxTicks` ticks (0 = as many as every chosen stock retains) of the first `maxSymbols` stocks
+    PriceTape(StockMarket& market, size_t maxSymbols, size_t maxTicks) : ticks(0) {
+        size_t n = min(maxSymbols, market.size());
+        size_t common = numeric_limits<size_t>::max();
+        for (size_t i = 0; i < n; ++i) {
+            symbols.push_back(market.getStockAt(i).getId());
+            common = min(common, market.getStockAt(i).getHistory().size());
+        }
+        ticks = n == 0 ? 0 : (maxTicks == 0 ? common : min(common, maxTicks));
+        prices.resize(ticks * n);
+        sums.assign((ticks + 1) * n, 0.0);
+        for (size_t s = 0; s < n; ++s) {
+            const PriceHistory& history = market.getStockAt(s).getHistory();
+            for (size_t t = 0; t < ticks; ++t) {
+                prices[t * n + s] = history.at(ticks - 1 - t);
+            }
+        }
+        for (size_t t = 0; t < ticks; ++t) {
+            for (size_t s = 0; s < n; ++s) {
+                sums[(t + 1) * n + s] = sums[t * n + s] + prices[t * n + s];
+            }
+        }
+    }
+
+    size_t symbolCount() const { return symbols.size(); }
+    size_t tickCount() const { return ticks; }
+    SymbolId symbol(size_t s) const { return symbols[s]; }
+    const double* at(size_t tick) const { return &prices[tick * symbols.size()]; }
+    double price(size_t tick, size_t s) const { return prices[tick * symbols.size() + s]; }
+
+    // Mean of the `n` prices ending at `tick` (requires tick + 1 >= n)
+    double average(size_t tick, size_t s, size_t n) const {
+        const size_t width = symbols.size();
+        return (sums[(tick + 1) * width + s] - sums[(tick + 1 - n) * width + s]) / n;
+    }
+};
+
+class BacktestAccount {
+private:
+    double initialCash;
+    double cash;
+    vector<int> shares;
+    vector<double> cost;
+    double realized;
+    double traded;
+
+public:
+    BacktestAccount(double startingCash, size_t symbolCount) :
+        initialCash(startingCash), cash(startingCash), shares(symbolCount, 0), cost(symbolCount, 0.0),
+        realized(0.0), traded(0.0) {}
+
+    bool buy(size_t s, int quantity, double price) {
+        double amount = quantity * price;
+        if (quantity <= 0 || amount > cash) return false;
+        cash -= amount;
+        shares[s] += quantity;
+        cost[s] += amount;
+        traded += amount;
+        return true;
+    }
+
+    bool sell(size_t s, int quantity, double price) {
+        if (quantity <= 0 || shares[s] < quantity) return false;
+        double soldCost = cost[s] * quantity / shares[s];
+        double proceeds = quantity * price;
+        cash += proceeds;
+        shares[s] -= quantity;
+        cost[s] -= soldCost;
+        realized += proceeds - soldCost;
+        traded += proceeds;
+        return true;
+    }
+
+    int holdings(size_t s) const { return shares[s]; }
+    double getCash() const { return cash; }
+    double getRealizedPnL() const { return realized; }
+    double getInitialCash() const { return initialCash; }
+    double getTraded() const { return traded; }
+
+    double equity(const double* prices) const {
+        double value = cash;
+        for (size_t s = 0; s < shares.size(); ++s) value += shares[s] * prices[s];
+        return value;
+    }
+};
+
+// Strategy interface: onTick sees the tape up to and including `tick` and
+// trades through the account. Strategies must not look at later ticks.
+class Strategy {
+public:
+    virtual ~Strategy() = default;
+    virtual string name() const = 0;
+    virtual size_t warmup() const = 0;  // ticks of history needed before the first onTick
+    virtual void onTick(const PriceTape& tape, size_t tick, BacktestAccount& account) = 0;
+};
+
+// Buys a lot when the fast average crosses above the slow one, exits when it crosses below
+class MovingAverageCrossover : public Strategy {
+private:
+    size_t fast, slow;
+    int lot;
+
+public:
+    MovingAverageCrossover(size_t f, size_t s, int l) : fast(f), slow(s), lot(l) {}
+    string name() const override { return "sma(" + to_string(fast) + "," + to_string(slow) + ")"; }
+    size_t warmup() const override { return slow + 1; }
+
+    void onTick(const PriceTape& tape, size_t tick, BacktestAccount& account) override {
+        for (size_t s = 0; s < tape.symbolCount(); ++s) {
+            bool above = tape.average(tick, s, fast) > tape.average(tick, s, slow);
+            bool wasAbove = tape.average(tick - 1, s, fast) > tape.average(tick - 1, s, slow);
+            if (above && !wasAbove) account.buy(s, lot, tape.price(tick, s));
+            else if (!above && wasAbove) account.sell(s, account.holdings(s), tape.price(tick, s));
+        }
+    }
+};
+
+// Buys when the price is `threshold` percent below its average, exits at the average
+class MeanReversion : public Strategy {
+private:
+    size_t window;
+    double threshold;
+    int lot;
+
+public:
+    MeanReversion(size_t w, double t, int l) : window(w), threshold(t), lot(l) {}
+    string name() const override {
+        ostringstream text;
+        text << "meanrev(" << window << "," << threshold << "%)";
+        return text.str();
+    }
+    size_t warmup() const override { return window; }
+
+    void onTick(const PriceTape& tape, size_t tick, BacktestAccount& account) override {
+        for (size_t s = 0; s < tape.symbolCount(); ++s) {
+            double price = tape.price(tick, s);
+            double mean = tape.average(tick, s, window);
+            if (price < mean * (1.0 - threshold / 100.0)) account.buy(s, lot, price);
+            else if (price >= mean && account.holdings(s) > 0) account.sell(s, account.holdings(s), price);
+        }
+    }
+};
+
+// Holds a lot while the price is above its level `lookback` ticks ago
+class Momentum : public Strategy {
+private:
+    size_t lookback;
+    int lot;
+
+public:
+    Momentum(size_t l, int size) : lookback(l), lot(size) {}
+    string name() const override { return "momentum(" + to_string(lookback) + ")"; }
+    size_t warmup() const override { return lookback + 1; }
+
+    void onTick(const PriceTape& tape, size_t tick, BacktestAccount& account) override {
+        for (size_t s = 0; s < tape.symbolCount(); ++s) {
+            double price = tape.price(tick, s);
+            bool rising = price > tape.price(tick - lookback, s);
+            if (rising && account.holdings(s) == 0) account.buy(s, lot, price);
+            else if (!rising && account.holdings(s) > 0) account.sell(s, account.holdings(s), price);
+        }
+    }
+};
+
+class Backtester {
+public:
+    struct RunResult {
+        string strategy;
+        double pnl;
+        double maxDrawdown;  // percent of peak equity
+        double turnover;     // traded notional / starting cash
+        long long trades;
+    };
+
+    struct Summary {
+        vector<RunResult> runs;
+        long long strategyTicks;
+        double seconds;
+    };
+
+    // The default grid: crossovers, mean reversion and momentum over a range of parameters
+    static vector<unique_ptr<Strategy>> parameterGrid(int lot = 10) {
+        vector<unique_ptr<Strategy>> strategies;
+        for (size_t fast : {2, 3, 4, 5, 6, 8, 10, 13}) {
+            for (size_t slow : {15, 20, 25, 30, 40, 50, 60, 80, 100, 120}) {
+                strategies.emplace_back(new MovingAverageCrossover(fast, slow, lot));
+            }
+        }
+        for (size_t window : {5, 10, 15, 20, 30, 40, 60, 80}) {
+            for (double threshold : {0.25, 0.5, 1.0, 1.5, 2.0, 3.0, 4.0, 5.0}) {
+                strategies.emplace_back(new MeanReversion(window, threshold, lot));
+            }
+        }
+        for (size_t lookback = 1; lookback <= 64; ++lookback) {
+            strategies.emplace_back(new Momentum(lookback, lot));
+        }
+        return strategies;
+    }
+
+    static Summary run(const PriceTape& tape, vector<unique_ptr<Strategy>>& strategies, double cash,
+                       WorkerPool* pool) {
+        auto start = chrono::steady_clock::now();
+        Summary summary{vector<RunResult>(strategies.size()), 0, 0.0};
+        vector<long long> ticksRun(strategies.size(), 0);
+        auto work = [&](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; ++r) {
+                Strategy& strategy = *strategies[r];
+                BacktestAccount account(cash, tape.symbolCount());
+                double peak = cash, drawdown = 0.0;
+                long long trades = 0;
+                double tradedBefore = 0.0;
+                for (size_t tick = strategy.warmup(); tick < tape.tickCount(); ++tick) {
+                    strategy.onTick(tape, tick, account);
+                    if (account.getTraded() != tradedBefore) {
+                        trades++;
+                        tradedBefore = account.getTraded();
+                    }
+                    double equity = account.equity(tape.at(tick));
+                    peak = max(peak, equity);
+                    drawdown = max(drawdown, (peak - equity) / peak * 100.0);
+                    ticksRun[r]++;
+                }
+                double finalEquity = tape.tickCount() > 0 ? account.equity(tape.at(tape.tickCount() - 1)) : cash;
+                summary.runs[r] = RunResult{strategy.name(), finalEquity - cash, drawdown, account.getTraded() / cash, trades};
+            }
+        };
+        runParallel(pool, strategies.size(), 1, work);
+        for (long long ticks : ticksRun) summary.strategyTicks += ticks;
+        summary.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return summary;
+    }
+
+    static void display(const Summary& summary, const PriceTape& tape, size_t top) {
+        vector<const RunResult*> ranked;
+        for (const RunResult& run : summary.runs) ranked.push_back(&run);
+        sort(ranked.begin(), ranked.end(), [](const RunResult* a, const RunResult* b) { return a->pnl > b->pnl; });
+
+        cout << "\n=== Backtest: " << summary.runs.size() << " runs, " << tape.symbolCount() << " symbols, "
+             << tape.tickCount() << " ticks ===\n";
+        cout << left << setw(22) << "Strategy" << right << setw(14) << "P&L" << setw(14) << "Drawdown %"
+             << setw(12) << "Turnover" << setw(12) << "Trade ticks" << "\n";
+        cout << fixed;
+        for (size_t i = 0; i < min(top, ranked.size()); ++i) {
+            const RunResult& run = *ranked[i];
+            cout << left << setw(22) << run.strategy << right << setprecision(2) << setw(14) << run.pnl
+                 << setw(14) << run.maxDrawdown << setw(12) << run.turnover << setw(12) << run.trades << "\n";
+        }
+        cout << left << summary.strategyTicks << " strategy-ticks in " << setprecision(3) << summary.seconds << " s ("
+             << setprecision(0) << (summary.seconds > 0 ? summary.strategyTicks / summary.seconds : 0.0)
+             << " strategy-ticks/s, " << (summary.seconds > 0 ? summary.strategyTicks * tape.symbolCount() / summary.seconds : 0.0)
+             << " symbol-ticks/s)\n";
+    }
+};
+
+// Snapshot Store
+// save() encodes the market and portfolios into one buffer at a single point
+// in time, then writes it (to a temp file renamed into place) on a background
+// thread so trading continues during the disk write. load() maps the file and
+// decodes it directly: retained price histories are copied in bulk, nothing is
+// replayed. Format: "STNKSNAP", version, symbol table, market, portfolios.
+class SnapshotStore {
+private:
+    static constexpr uint32_t VERSION = 3;  // 2: graph as weighted edge list; 3: position cost basis
+    thread writer;
+
+public:
+    ~SnapshotStore() { wait(); }
+
+    void wait() {
+        if (writer.joinable()) writer.join();
+    }
+
+    void save(const string& path, const StockMarket& market, const PortfolioManager& portfolioManager,
+              bool background = true) {
+        SnapshotWriter out;
+        out.put<uint64_t>(0x50414E534B4E5453ULL);  // "STNKSNAP"
+        out.put<uint32_t>(VERSION);
+        out.putSymbolTable();
+        {
+            // Trades move shares between stocks and holdings under these locks,
+            // so both halves of the snapshot come from the same moment
+            vector<unique_lock<mutex>> locks = portfolioManager.lockShards();
+            market.save(out);
+            portfolioManager.save(out);
+        }
+
+        wait();  // one write in flight at a time
+        auto write = [path](vector<char> bytes) {
+            string temporary = path + ".tmp";
+            FILE* file = fopen(temporary.c_str(), "wb");
+            bool ok = file && fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+            if (file) ok = fclose(file) == 0 && ok;
+            if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+                cerr << "Snapshot write failed: " << path << "\n";
+            }
+        };
+        if (background) {
+            writer = thread(write, move(out.data()));
+        } else {
+            write(move(out.data()));
+        }
+    }
+
+    void load(const string& path, StockMarket& market, PortfolioManager& portfolioManager) {
+        wait();
+        MappedFile file(path);
+        SnapshotReader in(file.data(), file.size());
+        if (in.get<uint64_t>() != 0x50414E534B4E5453ULL) {
+            throw runtime_error("Not a snapshot file: " + path);
+        }
+        if (in.get<uint32_t>() != VERSION) {
+            throw runtime_error("Unsupported snapshot version");
+        }
+        in.readSymbolTable();
+        StockMarket::Restored stagedMarket = StockMarket::decode(in);
+        PortfolioManager::Restored stagedPortfolios = PortfolioManager::decode(in, stagedMarket);
+        market.install(stagedMarket);
+        portfolioManager.install(stagedPortfolios, market);
+    }
+};
+
+// Event Scheduler
+// A simulated-clock event loop over a hashed timer wheel: SLOTS buckets of
+// RESOLUTION microseconds each, an event sitting in bucket (slot % SLOTS)
+// until the wheel reaches its absolute slot. Each stock can tick at its own
+// rate; a stock with rate 0 has no event in the wheel and costs nothing.
+// Orders, price alerts and snapshots are one-shot or repeating timed events.
+// Events due in the same slot fire in (time, scheduling order), so a run is
+// deterministic. run() goes as fast as possible (speed 0) or paces simulated
+// time to `speed` x wall-clock time.
+class MarketScheduler {
+public:
+    static constexpr int64_t RESOLUTION = 100;  // microseconds per slot
+    static constexpr size_t SLOTS = 4096;
+
+    enum class EventKind : uint8_t { SymbolTick, Order, Alert, Snapshot };
+
+    struct RunResult {
+        long long symbolTicks;
+        long long otherEvents;
+        double seconds;
+    };
+
+private:
+    struct Event {
+        int64_t due;          // simulated microseconds
+        int64_t slot;         // absolute wheel slot (due / RESOLUTION, or later)
+        uint64_t sequence;
+        int64_t every;        // repeat interval, 0 = one-shot
+        SymbolId symbol;
+        uint32_t generation;  // SymbolTick: stale when the stock's rate changed since
+        EventKind kind;
+        bool flag;            // Order: buy; Alert: above
+        int quantity;
+        double price;
+        uint32_t path;        // Snapshot: index into snapshotPaths
+    };
+
+    StockMarket& market;
+    PortfolioManager& portfolioManager;
+    SnapshotStore& snapshots;
+
+    vector<vector<Event>> wheel;
+    int64_t now;
+    int64_t cursor;  // absolute slot being processed
+    uint64_t nextSequence;
+    size_t pending;
+    vector<int64_t> tickPeriod;       // per SymbolId, microseconds; 0 = idle
+    vector<uint32_t> tickGeneration;  // per SymbolId
+    vector<string> snapshotPaths;
+    vector<Event> ready;
+    long long symbolTicks;
+    long long otherEvents;
+
+    void schedule(Event event) {
+        event.due = max(event.due, now);
+        event.slot = max(event.due / RESOLUTION, cursor);
+        event.sequence = nextSequence++;
+        wheel[event.slot % SLOTS].push_back(event);
+        pending++;
+    }
+
+    static string timestamp(int64_t micros) {
+        ostringstream text;
+        text << "[t=" << fixed << setprecision(3) << micros / 1000.0 << "ms] ";
+        return text.str();
+    }
+
+    void fire(const Event& event) {
+        now = event.due;
+        switch (event.kind) {
+            case EventKind::SymbolTick: {
+                if (event.symbol >= tickGeneration.size() || event.generation != tickGeneration[event.symbol]) {
+                    return;  // rate changed; a newer event carries the stock
+                }
+                market.advanceStock(event.symbol);
+                symbolTicks++;
+                Event next = event;
+                next.due = event.due + tickPeriod[event.symbol];
+                schedule(next);
+                return;
+            }
+            case EventKind::Order: {
+                const string& symbol = symbolTable().name(event.symbol);
+                long long id = market.submitOrder(symbol, event.flag, event.quantity, event.price);
+                cout << timestamp(now) << "Order " << id << ": " << (event.flag ? "buy " : "sell ") << event.quantity
+                     << " " << symbol << " @ $" << fixed << setprecision(2) << event.price << "\n";
+                break;
+            }
+            case EventKind::Alert: {
+                double price = market.getStock(event.symbol).getCurrentPrice();
+                if (event.flag ? price >= event.price : price <= event.price) {
+                    cout << timestamp(now) << "ALERT " << symbolTable().name(event.symbol) << " at $" << fixed
+                         << setprecision(2) << price << (event.flag ? " >= $" : " <= $") << event.price << "\n";
+                    otherEvents++;
+                    return;  // an alert fires once
+                }
+                break;
+            }
+            case EventKind::Snapshot:
+                snapshots.save(snapshotPaths[event.path], market, portfolioManager);
+                cout << timestamp(now) << "Snapshot " << snapshotPaths[event.path] << "\n";
+                break;
+        }
+        otherEvents++;
+        if (event.every > 0) {
+            Event next = event;
+            next.due = event.due + event.every;
+            schedule(next);
+        }
+    }
+
+    // Fires everything in the current slot that is due by `limit`, including
+    // events scheduled into this slot while it is being processed
+    void processSlot(int64_t limit) {
+        vector<Event>& slot = wheel[cursor % SLOTS];
+        while (true) {
+            ready.clear();
+            size_t kept = 0;
+            for (size_t i = 0; i < slot.size(); ++i) {
+                if (slot[i].slot <= cursor && slot[i].due <= limit) ready.push_back(slot[i]);
+                else slot[kept++] = slot[i];
+            }
+            slot.resize(kept);
+            if (ready.empty()) return;
+            pending -= ready.size();
+            sort(ready.begin(), ready.end(), [](const Event& a, const Event& b) {
+                return a.due != b.due ? a.due < b.due : a.sequence < b.sequence;
+            });
+            vector<Event> firing;
+            firing.swap(ready);
+            for (const Event& event : firing) {
+                // One failing event (an order outside the price band, a failed
+                // snapshot write) must not drop the rest of the slot
+                try {
+                    fire(event);
+                } catch (const runtime_error& error) {
+                    cout << timestamp(event.due) << "Event failed: " << error.what() << "\n";
+                }
+            }
+            ready.swap(firing);
+        }
+    }
+
+    // Earliest absolute slot holding an event. Walks the buckets from the cursor
+    // for one revolution, then falls back to the minimum over every event
+    // (all of them are at least a revolution away). Requires pending > 0.
+    int64_t nextDueSlot() const {
+        int64_t earliest = numeric_limits<int64_t>::max();
+        for (size_t k = 0; k < SLOTS; ++k) {
+            for (const Event& event : wheel[(cursor + k) % SLOTS]) {
+                if (event.slot <= cursor + (int64_t)k) return cursor + (int64_t)k;
+                earliest = min(earliest, event.slot);
+            }
+        }
+        return earliest;
+    }
+
+    Event makeEvent(EventKind kind, int64_t delay, SymbolId symbol = INVALID_SYMBOL) const {
+        Event event{};
+        event.kind = kind;
+        event.due = now + max<int64_t>(delay, 0);
+        event.symbol = symbol;
+        return event;
+    }
+
+public:
+    MarketScheduler(StockMarket& m, PortfolioManager& pm, SnapshotStore& store) :
+        market(m), portfolioManager(pm), snapshots(store), wheel(SLOTS), now(0), cursor(0), nextSequence(0),
+        pending(0), symbolTicks(0), otherEvents(0) {}
+
+    int64_t getTime() const { return now; }
+    size_t pendingEvents() const { return pending; }
+
+    // ticksPerSecond 0 makes the stock idle
+    void setTickRate(SymbolId symbol, double ticksPerSecond) {
+        market.getStock(symbol);  // must be listed
+        if (symbol >= tickPeriod.size()) {
+            tickPeriod.resize(symbol + 1, 0);
+            tickGeneration.resize(symbol + 1, 0);
+        }
+        tickGeneration[symbol]++;  // retires any pending tick event
+        tickPeriod[symbol] = ticksPerSecond > 0 ? max<int64_t>(1, (int64_t)(1e6 / ticksPerSecond)) : 0;
+        if (tickPeriod[symbol] > 0) {
+            Event event = makeEvent(EventKind::SymbolTick, tickPeriod[symbol], symbol);
+            event.generation = tickGeneration[symbol];
+            schedule(event);
+        }
+    }
+
+    void scheduleOrder(int64_t delay, SymbolId symbol, bool buy, int quantity, double price) {
+        market.getStock(symbol);  // must be listed
+        if (quantity <= 0) throw runtime_error("Share count must be positive");
+        if (!(price > 0.0 && isfinite(price))) throw runtime_error("Limit price must be positive");
+        Event event = makeEvent(EventKind::Order, delay, symbol);
+        event.flag = buy;
+        event.quantity = quantity;
+        event.price = price;
+        schedule(event);
+    }
+
+    // Checked at `delay`, then every `every` microseconds until it triggers (0 = checked once)
+    void scheduleAlert(int64_t delay, SymbolId symbol, bool above, double price, int64_t every) {
+        market.getStock(symbol);  // must be listed
+        if (!(price > 0.0 && isfinite(price))) throw runtime_error("Alert price must be positive");
+        Event event = makeEvent(EventKind::Alert, delay, symbol);
+        event.flag = above;
+        event.price = price;
+        event.every = every;
+        schedule(event);
+    }
+
+    void scheduleSnapshot(int64_t delay, const string& path, int64_t every) {
+        Event event = makeEvent(EventKind::Snapshot, delay);
+        event.path = snapshotPaths.size();
+        event.every = every;
+        snapshotPaths.push_back(path);
+        schedule(event);
+    }
+
+    // Advances the simulated clock by `duration` microseconds
+    RunResult run(int64_t duration, double speed = 0.0) {
+        auto wallStart = chrono::steady_clock::now();
+        const int64_t simStart = now;
+        const int64_t end = now + max<int64_t>(duration, 0);
+        symbolTicks = 0;
+        otherEvents = 0;
+        while (true) {
+            // Jump straight to the next occupied slot instead of stepping through empty ones
+            int64_t due = pending > 0 ? nextDueSlot() : numeric_limits<int64_t>::max();
+            if (due > end / RESOLUTION) {
+                cursor = max(cursor, end / RESOLUTION);
+                break;
+            }
+            cursor = due;
+            int64_t slotStart = cursor * RESOLUTION;
+            if (speed > 0) {
+                this_thread::sleep_until(wallStart + chrono::microseconds((int64_t)((max(slotStart, simStart) - simStart) / speed)));
+            }
+            processSlot(end);
+            if ((cursor + 1) * RESOLUTION > end) break;
+            cursor++;
+        }
+        now = end;
+        return RunResult{symbolTicks, otherEvents, chrono::duration<double>(chrono::steady_clock::now() - wallStart).count()};
+    }
+};
+
+// Historical Tick Replay
+// Feeds recorded prices through StockMarket::applyTick. Input is mapped and
+// parsed in place (from_chars, no per-line strings) in one of two formats:
+//   CSV:    timestamp_ms,symbol,price per line (lines that don't parse, such
+//           as a header, are skipped and counted)
+//   Binary: "STNKTICK", version, symbol names, then fixed 24-byte records
+// Ticks whose price is not positive are skipped and counted in either format.
+// speed 0 replays as fast as possible; speed S > 0 paces to S x wall clock.
+class TickReplayer {
+public:
+    struct Result {
+        long long ticks;
+        long long skipped;
+        double seconds;
+    };
+
+private:
+    static constexpr uint64_t MAGIC = 0x4B4349544B4E5453ULL;  // "STNKTICK"
+    static constexpr uint32_t VERSION = 1;
+
+    struct BinaryTick {
+        int64_t timestamp;
+        uint32_t symbol;
+        uint32_t reserved;
+        double price;
+    };
+    static_assert(sizeof(BinaryTick) == 24, "BinaryTick must stay 24 bytes");
+
+    // Sleeps until `timestamp` is due relative to the first replayed tick
+    class Pacer {
+    private:
+        double speed;
+        bool started;
+        int64_t firstTimestamp;
+        chrono::steady_clock::time_point start;
+
+    public:
+        explicit Pacer(double s) : speed(s), started(false), firstTimestamp(0) {}
+
+        void wait(int64_t timestamp) {
+            if (speed <= 0) return;
+            if (!started) {
+                started = true;
+                firstTimestamp = timestamp;
+                start = chrono::steady_clock::now();
+                return;
+            }
+            auto due = start + chrono::duration_cast<chrono::steady_clock::duration>(
+                chrono::duration<double, milli>((timestamp - firstTimestamp) / speed));
+            if (due > chrono::steady_clock::now()) {
+                this_thread::sleep_until(due);
+            }
+        }
+    };
+
+    static bool isBinary(const char* data, size_t size) {
+        uint64_t magic = 0;
+        if (size >= sizeof(magic)) memcpy(&magic, data, sizeof(magic));
+        return magic == MAGIC;
+    }
+
+    static const char* find(const char* from, const char* to, char c) {
+        return from < to ? (const char*)memchr(from, c, (size_t)(to - from)) : nullptr;
+    }
+
+    // visit(timestamp, symbol chars, symbol length, price) per parsed line; returns skipped lines
+    template <typename Visitor>
+    static long long parseCsv(const char* data, size_t size, Visitor visit) {
+        const char* cursor = data;
+        const char* end = data + size;
+        long long skipped = 0;
+        while (cursor < end) {
+            const char* lineEnd = find(cursor, end, '\n');
+            if (!lineEnd) lineEnd = end;
+            const char* valueEnd = (lineEnd > cursor && lineEnd[-1] == '\r') ? lineEnd - 1 : lineEnd;
+
+            const char* comma1 = find(cursor, valueEnd, ',');
+            const char* comma2 = comma1 ? find(comma1 + 1, valueEnd, ',') : nullptr;
+            int64_t timestamp = 0;
+            double price = 0.0;
+            // Each number must run up to its delimiter: "12x" is a bad line, not 12
+            auto parsed = [](from_chars_result result, const char* until) {
+                return result.ec == errc() && result.ptr == until;
+            };
+            if (comma2 && comma2 > comma1 + 1 &&
+                parsed(from_chars(cursor, comma1, timestamp), comma1) &&
+                parsed(from_chars(comma2 + 1, valueEnd, price), valueEnd)) {
+                visit(timestamp, comma1 + 1, (size_t)(comma2 - comma1 - 1), price);
+            } else if (valueEnd > cursor) {
+                skipped++;
+            }
+            cursor = lineEnd + 1;
+        }
+        return skipped;
+    }
+
+public:
+    static Result replay(const string& path, StockMarket& market, double speed = 0.0) {
+        MappedFile file(path);
+        Pacer pacer(speed);
+        Result result = {0, 0, 0.0};
+        auto start = chrono::steady_clock::now();
+
+        if (isBinary(file.data(), file.size())) {
+            SnapshotReader in(file.data(), file.size());
+            in.get<uint64_t>();
+            if (in.get<uint32_t>() != VERSION) {
+                throw runtime_error("Unsupported tick file version");
+            }
+            in.readSymbolTable();
+            uint64_t count = in.getCount(sizeof(BinaryTick));
+            for (uint64_t i = 0; i < count; ++i) {
+                BinaryTick tick = in.get<BinaryTick>();
+                pacer.wait(tick.timestamp);
+                if (market.applyTick(in.mapSymbol(tick.symbol), tick.price)) result.ticks++;
+                else result.skipped++;
+            }
+        } else {
+            string symbol;  // reused, so lookups don't allocate
+            result.skipped += parseCsv(file.data(), file.size(),
+                [&](int64_t timestamp, const char* name, size_t length, double price) {
+                    pacer.wait(timestamp);
+                    symbol.assign(name, length);
+                    if (market.applyTick(symbolTable().intern(symbol), price)) result.ticks++;
+                    else result.skipped++;
+                });
+        }
+
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return result;
+    }
+
+    // Writes the binary form of a CSV tick file; returns the number of ticks
+    static long long convertCsvToBinary(const string& csvPath, const string& binaryPath) {
+        MappedFile file(csvPath);
+        unordered_map<string, uint32_t> ids;
+        vector<string> names;
+        vector<BinaryTick> ticks;
+        string symbol;
+        parseCsv(file.data(), file.size(),
+            [&](int64_t timestamp, const char* name, size_t length, double price) {
+                symbol.assign(name, length);
+                auto inserted = ids.emplace(symbol, (uint32_t)names.size());
+                if (inserted.second) names.push_back(symbol);
+                ticks.push_back(BinaryTick{timestamp, inserted.first->second, 0, price});
+            });
+
+        SnapshotWriter out;
+        out.put<uint64_t>(MAGIC);
+        out.put<uint32_t>(VERSION);
+        out.put<uint64_t>(names.size());
+        for (const string& name : names) {
+            out.putString(name);
+        }
+        out.put<uint64_t>(ticks.size());
+        const vector<char>& bytes = out.data();
+
+        FILE* output = fopen(binaryPath.c_str(), "wb");
+        bool ok = output && fwrite(bytes.data(), 1, bytes.size(), output) == bytes.size() &&
+            fwrite(ticks.data(), sizeof(BinaryTick), ticks.size(), output) == ticks.size();
+        if (output) ok = fclose(output) == 0 && ok;
+        if (!ok) throw runtime_error("Cannot write tick file " + binaryPath);
+        return (long long)ticks.size();
+    }
+};
+
+// Bulk Export
+// Writes the market, full price histories (spilled + retained) and trade logs
+// as CSV or as a columnar binary file. Rows are formatted with to_chars into
+// per-block buffers, blocks are formatted in parallel on the WorkerPool and
+// then appended in order to one large output buffer that goes to the file
+// with a single write() per OUTPUT_CHUNK bytes.
+// Columnar format ("STNKCOLS", version 1, little-endian, 8-byte aligned):
+//   header:  magic, u32 version, u32 columnCount, then per column
+//            u8 type, u8 nameLength, name; padded
+//   dicts:   for each DICT column, u64 count then (u32 length, bytes) strings; padded
+//   batches: u64 rows (0 ends the file), then each column's values; padded
+class BulkExporter {
+public:
+    enum class Format { Csv, Columnar };
+    enum ColumnType : uint8_t { DICT = 1, I64 = 2, F64 = 3, U8 = 4 };  // DICT: u32 index into the column's dictionary
+
+    struct Result {
+        uint64_t rows;
+        uint64_t bytes;
+        double seconds;
+    };
+
+private:
+    static constexpr size_t OUTPUT_CHUNK = 64 << 20;
+    static constexpr size_t ITEMS_PER_BLOCK = 256;
+
+    // Growable byte buffer without vector's zero-fill on resize
+    struct ByteBuffer {
+        unique_ptr<char[]> bytes;
+        size_t size = 0;
+        size_t capacity = 0;
+
+        char* reserve(size_t n) {
+            if (size + n > capacity) {
+                size_t newCapacity = max(capacity * 2, size + n);
+                unique_ptr<char[]> grown(new char[newCapacity]);
+                if (size) memcpy(grown.get(), bytes.get(), size);
+                bytes = move(grown);
+                capacity = newCapacity;
+            }
+            return bytes.get() + size;
+        }
+        void commit(char* end) { size = end - bytes.get(); }
+        void append(const void* data, size_t n) {
+            memcpy(reserve(n), data, n);
+            size += n;
+        }
+        template <typename T>
+        void put(const T& value) { append(&value, sizeof(T)); }
+        void pad() {
+            static const char zeros[8] = {};
+            if (size % 8) append(zeros, 8 - size % 8);
+        }
+        void clear() { size = 0; }
+    };
+
+    class OutputFile {
+    private:
+        FILE* file;
+        ByteBuffer pending;
+        uint64_t written;
+
+    public:
+        explicit OutputFile(const string& path) : file(fopen(path.c_str(), "wb")), written(0) {
+            if (!file) throw runtime_error("Cannot open export file " + path);
+            pending.reserve(OUTPUT_CHUNK);
+        }
+        ~OutputFile() {
+            if (file) fclose(file);
+        }
+
+        void append(const ByteBuffer& block) {
+            if (pending.size + block.size > OUTPUT_CHUNK) flush();
+            pending.append(block.bytes.get(), block.size);
+        }
+
+        void flush() {
+            if (pending.size == 0) return;
+#ifndef _WIN32
+            const char* data = pending.bytes.get();
+            size_t left = pending.size;
+            while (left > 0) {
+                ssize_t n = ::write(fileno(file), data, left);
+                if (n <= 0) throw runtime_error("Export write failed");
+                data += n;
+                left -= n;
+            }
+#else
+            if (fwrite(pending.bytes.get(), 1, pending.size, file) != pending.size) {
+                throw runtime_error("Export write failed");
+            }
+#endif
+            written += pending.size;
+            pending.clear();
+        }
+
+        uint64_t close() {
+            flush();
+            if (fclose(file) != 0) throw runtime_error("Export close failed");
+            file = nullptr;
+            return written;
+        }
+    };
+
+    struct Column {
+        const char* name;
+        ColumnType type;
+    };
+
+    static char* putText(char* out, const string& text) {
+        memcpy(out, text.data(), text.size());
+        return out + text.size();
+    }
+
+    // Shortest round-trip formatting; callers reserve 32 bytes per number
+    template <typename T>
+    static char* putNumber(char* out, T value) {
+        return to_chars(out, out + 32, value).ptr;
+    }
+
+    static void writeHeader(OutputFile& file, const vector<Column>& columns, const vector<const vector<string>*>& dictionaries) {
+        ByteBuffer header;
+        header.append("STNKCOLS", 8);
+        header.put<uint32_t>(1);
+        header.put<uint32_t>((uint32_t)columns.size());
+        for (const Column& column : columns) {
+            header.put<uint8_t>(column.type);
+            header.put<uint8_t>((uint8_t)strlen(column.name));
+            header.append(column.name, strlen(column.name));
+        }
+        header.pad();
+        for (const vector<string>* dictionary : dictionaries) {
+            header.put<uint64_t>(dictionary->size());
+            for (const string& entry : *dictionary) {
+                header.put<uint32_t>((uint32_t)entry.size());
+                header.append(entry.data(), entry.size());
+            }
+            header.pad();
+        }
+        file.append(header);
+    }
+
+    static void writeCsvHeader(OutputFile& file, const vector<Column>& columns) {
+        ByteBuffer header;
+        for (size_t c = 0; c < columns.size(); ++c) {
+            if (c) header.append(",", 1);
+            header.append(columns[c].name, strlen(columns[c].name));
+        }
+        header.append("\n", 1);
+        file.append(header);
+    }
+
+    // Formats items [0, count) in blocks of ITEMS_PER_BLOCK, a wave of blocks
+    // at a time in parallel, and appends the blocks to the file in order.
+    // format(begin, end, buffer) appends the block's bytes and returns its rows.
+    template <typename FormatBlock>
+    static uint64_t writeBlocks(OutputFile& file, size_t count, WorkerPool* pool, FormatBlock format) {
+        size_t blocks = (count + ITEMS_PER_BLOCK - 1) / ITEMS_PER_BLOCK;
+        size_t wave = pool ? pool->threadCount() * 4 : 1;
+        vector<ByteBuffer> buffers(wave);
+        vector<uint64_t> rows(wave);
+        uint64_t total = 0;
+        for (size_t first = 0; first < blocks; first += wave) {
+            size_t inWave = min(wave, blocks - first);
+            auto work = [&](size_t begin, size_t end) {
+                for (size_t b = begin; b < end; ++b) {
+                    size_t itemBegin = (first + b) * ITEMS_PER_BLOCK;
+                    buffers[b].clear();
+                    rows[b] = format(itemBegin, min(count, itemBegin + ITEMS_PER_BLOCK), buffers[b]);
+                }
+            };
+            runParallel(pool, inWave, 1, work);
+            for (size_t b = 0; b < inWave; ++b) {
+                file.append(buffers[b]);
+                total += rows[b];
+            }
+        }
+        return total;
+    }
+
+    static Result finish(OutputFile& file, Format format, uint64_t rows, chrono::steady_clock::time_point start) {
+        if (format == Format::Columnar) {
+            ByteBuffer end;
+            end.put<uint64_t>(0);
+            file.append(end);
+        }
+        uint64_t bytes = file.close();
+        return Result{rows, bytes, chrono::duration<double>(chrono::steady_clock::now() - start).count()};
+    }
+
+public:
+    // One row per listed stock: symbol, price, open, volume, available shares, ticks
+    static Result exportMarket(const string& path, StockMarket& market, Format format) {
+        auto start = chrono::steady_clock::now();
+        OutputFile file(path);
+        vector<Column> columns = {{"symbol", DICT}, {"price", F64}, {"open", F64}, {"volume", I64},
+                                  {"available_shares", I64}, {"ticks", I64}};
+        if (format == Format::Csv) writeCsvHeader(file, columns);
+        else writeHeader(file, columns, {&symbolTable().allNames()});
+
+        auto block = [&](size_t begin, size_t end, ByteBuffer& out) -> uint64_t {
+            if (format == Format::Csv) {
+                for (size_t i = begin; i < end; ++i) {
+                    const Stock& stock = market.getStockAt(i);
+                    char* p = out.reserve(stock.getSymbol().size() + 5 * 32 + 8);
+                    p = putText(p, stock.getSymbol());
+                    *p++ = ',';
+                    p = putNumber(p, stock.getCurrentPrice());
+                    *p++ = ',';
+                    p = putNumber(p, stock.getOpenPrice());
+                    *p++ = ',';
+                    p = putNumber(p, stock.getVolume());
+                    *p++ = ',';
+                    p = putNumber(p, stock.getAvailableShares());
+                    *p++ = ',';
+                    p = putNumber(p, stock.getHistory().totalTicks());
+                    *p++ = '\n';
+                    out.commit(p);
+                }
+            } else {
+                size_t n = end - begin;
+                out.put<uint64_t>(n);
+                for (size_t i = begin; i < end; ++i) out.put<uint32_t>(market.getStockAt(i).getId());
+                out.pad();
+                for (size_t i = begin; i < end; ++i) out.put<double>(market.getStockAt(i).getCurrentPrice());
+                for (size_t i = begin; i < end; ++i) out.put<double>(market.getStockAt(i).getOpenPrice());
+                for (size_t i = begin; i < end; ++i) out.put<int64_t>(market.getStockAt(i).getVolume());
+                for (size_t i = begin; i < end; ++i) out.put<int64_t>(market.getStockAt(i).getAvailableShares());
+                for (size_t i = begin; i < end; ++i) out.put<int64_t>(market.getStockAt(i).getHistory().totalTicks());
+            }
+            return end - begin;
+        };
+        uint64_t rows = writeBlocks(file, market.size(), market.getWorkerPool(), block);
+        return finish(file, format, rows, start);
+    }
+
+    // One row per recorded price: symbol, tick, price. Spilled prices are
+    // read back from the spill files, so the export covers every tick kept.
+    static Result exportHistory(const string& path, StockMarket& market, Format format) {
+        auto start = chrono::steady_clock::now();
+        OutputFile file(path);
+        vector<Column> columns = {{"symbol", DICT}, {"tick", I64}, {"price", F64}};
+        if (format == Format::Csv) writeCsvHeader(file, columns);
+        else writeHeader(file, columns, {&symbolTable().allNames()});
+
+        auto block = [&](size_t begin, size_t end, ByteBuffer& out) -> uint64_t {
+            vector<double> prices;
+            vector<uint32_t> symbolColumn;
+            vector<int64_t> tickColumn;
+            vector<double> priceColumn;
+            uint64_t rows = 0;
+            for (size_t i = begin; i < end; ++i) {
+                const Stock& stock = market.getStockAt(i);
+                const PriceHistory& history = stock.getHistory();
+
+                // Oldest first: spilled prices, then the retained ring
+                long long spilled = history.spilledTicks();
+                prices.resize(spilled + history.size());
+                size_t read = spilled > 0 ? history.readSpilled(0, spilled, prices.data()) : 0;
+                prices.resize(read + history.size());
+                for (size_t age = history.size(); age-- > 0;) {
+                    prices[read + history.size() - 1 - age] = history.at(age);
+                }
+                int64_t firstTick = history.totalTicks() - (int64_t)prices.size();
+                rows += prices.size();
+
+                if (format == Format::Csv) {
+                    const string& symbol = stock.getSymbol();
+                    char* p = out.reserve(prices.size() * (symbol.size() + 2 * 32 + 3));
+                    for (size_t k = 0; k < prices.size(); ++k) {
+                        p = putText(p, symbol);
+                        *p++ = ',';
+                        p = putNumber(p, firstTick + (int64_t)k);
+                        *p++ = ',';
+                        p = putNumber(p, prices[k]);
+                        *p++ = '\n';
+                    }
+                    out.commit(p);
+                } else {
+                    symbolColumn.insert(symbolColumn.end(), prices.size(), stock.getId());
+                    for (size_t k = 0; k < prices.size(); ++k) tickColumn.push_back(firstTick + (int64_t)k);
+                    priceColumn.insert(priceColumn.end(), prices.begin(), prices.end());
+                }
+            }
+            if (format == Format::Columnar && rows > 0) {  // a 0-row batch would read as the end marker
+                out.put<uint64_t>(rows);
+                out.append(symbolColumn.data(), symbolColumn.size() * sizeof(uint32_t));
+                out.pad();
+                out.append(tickColumn.data(), tickColumn.size() * sizeof(int64_t));
+                out.append(priceColumn.data(), priceColumn.size() * sizeof(double));
+            }
+            return rows;
+        };
+        uint64_t rows = writeBlocks(file, market.size(), market.getWorkerPool(), block);
+        return finish(file, format, rows, start);
+    }
+
+    // One row per trade: portfolio, timestamp (ns), side, symbol, quantity, price
+    static Result exportTrades(const string& path, const PortfolioManager& portfolioManager, WorkerPool* pool,
+                               Format format) {
+        auto start = chrono::steady_clock::now();
+        // Held for the whole export: row counts and rows must come from the same journals
+        vector<unique_lock<mutex>> locks = portfolioManager.lockShards();
+        vector<pair<const string*, const Portfolio*>> portfolios = portfolioManager.listPortfolios();
+        vector<string> portfolioNames;
+        for (const auto& entry : portfolios) portfolioNames.push_back(*entry.first);
+
+        OutputFile file(path);
+        vector<Column> columns = {{"portfolio", DICT}, {"timestamp", I64}, {"side", U8}, {"symbol", DICT},
+                                  {"quantity", I64}, {"price", F64}};
+        if (format == Format::Csv) writeCsvHeader(file, columns);
+        else writeHeader(file, columns, {&portfolioNames, &symbolTable().allNames()});
+
+        auto block = [&](size_t begin, size_t end, ByteBuffer& out) -> uint64_t {
+            uint64_t rows = 0;
+            for (size_t i = begin; i < end; ++i) rows += portfolios[i].second->getJournal().size();
+            if (format == Format::Csv) {
+                for (size_t i = begin; i < end; ++i) {
+                    const string& name = *portfolios[i].first;
+                    const TradeJournal& journal = portfolios[i].second->getJournal();
+                    for (size_t r = 0; r < journal.size(); ++r) {
+                        const TradeRecord& record = journal[r];
+                        const string& symbol = symbolTable().name(record.symbol);
+                        char* p = out.reserve(name.size() + symbol.size() + 4 * 32 + 16);
+                        p = putText(p, name);
+                        *p++ = ',';
+                        p = putNumber(p, record.timestamp);
+                        p = putText(p, record.side == 0 ? string(",buy,") : string(",sell,"));
+                        p = putText(p, symbol);
+                        *p++ = ',';
+                        p = putNumber(p, record.quantity);
+                        *p++ = ',';
+                        p = putNumber(p, record.price);
+                        *p++ = '\n';
+                        out.commit(p);
+                    }
+                }
+            } else if (rows > 0) {  // a 0-row batch would read as the end marker
+                out.put<uint64_t>(rows);
+                for (size_t i = begin; i < end; ++i) {
+                    for (size_t r = 0; r < portfolios[i].second->getJournal().size(); ++r) out.put<uint32_t>((uint32_t)i);
+                }
+                out.pad();
+                auto eachRecord = [&](auto emit) {
+                    for (size_t i = begin; i < end; ++i) {
+                        const TradeJournal& journal = portfolios[i].second->getJournal();
+                        for (size_t r = 0; r < journal.size(); ++r) emit(journal[r]);
+                    }
+                };
+                eachRecord([&](const TradeRecord& record) { out.put<int64_t>(record.timestamp); });
+                eachRecord([&](const TradeRecord& record) { out.put<uint8_t>(record.side); });
+                out.pad();
+                eachRecord([&](const TradeRecord& record) { out.put<uint32_t>(record.symbol); });
+                out.pad();
+                eachRecord([&](const TradeRecord& record) { out.put<int64_t>(record.quantity); });
+                eachRecord([&](const TradeRecord& record) { out.put<double>(record.price); });
+            }
+            return rows;
+        };
+        uint64_t rows = writeBlocks(file, portfolios.size(), pool, block);
+        return finish(file, format, rows, start);
+    }
+};
+
+// Checked Number Parsing
+// Numeric text must parse completely: "12abc" is an error, not 12. `parse` is
+// a stoi-style call taking (text, size_t* used); its logic_errors become a
+// runtime_error, which every command and option handler reports.
+template <typename Parse>
+auto parseNumber(const string& text, Parse parse) -> decltype(parse(string(), (size_t*)nullptr)) {
+    try {
+        size_t used = 0;
+        auto value = parse(text, &used);
+        if (used == text.size()) return value;
+    } catch (const logic_error&) {
+    }
+    throw runtime_error("Expected a number, got '" + text + "'");
+}
+
+// Batch Runner for scripted/headless sessions
+// Reads one command per line (e.g. "buy AAPL 10") and drives the same
+// StockMarket and PortfolioManager APIs as the interactive menu, without
+// echoing the menu. Blank lines and lines starting with '#' are ignored.
+class BatchRunner {
+private:
+    StockMarket& market;
+    PortfolioManager& portfolioManager;
+    SnapshotStore snapshots;
+    MarketScheduler scheduler;
+    vector<string> tokens;
+    long long commandsExecuted;
+    long long commandErrors;
+
+    void tokenize(const string& line) {
+        tokens.clear();
+        size_t i = 0;
+        while (i < line.size()) {
+            while (i < line.size() && isspace((unsigned char)line[i])) i++;
+            if (i >= line.size() || line[i] == '#') break;
+            size_t start = i;
+            while (i < line.size() && !isspace((unsigned char)line[i])) i++;
+            tokens.emplace_back(line, start, i - start);
+        }
+    }
+
+    const string& arg(size_t index) const {
+        if (index >= tokens.size()) {
+            throw runtime_error("Missing argument for '" + tokens[0] + "'");
+        }
+        return tokens[index];
+    }
+
+    template <typename Parse>
+    auto numberArg(size_t index, Parse parse) const -> decltype(parse(string(), (size_t*)nullptr)) {
+        return parseNumber(arg(index), parse);
+    }
+
+    int intArg(size_t index) const {
+        return numberArg(index, [](const string& token, size_t* used) { return stoi(token, used); });
+    }
+
+    // Counts and sizes: values below `minimum` would wrap when cast to size_t
+    int intArg(size_t index, int minimum) const {
+        int value = intArg(index);
+        if (value < minimum) {
+            throw runtime_error(tokens[0] + " needs a value of at least " + to_string(minimum) + ", got " + tokens[index]);
+        }
+        return value;
+    }
+
+    long long longArg(size_t index) const {
+        return numberArg(index, [](const string& token, size_t* used) { return stoll(token, used); });
+    }
+
+    // stoull would wrap "-1" to 2^64 - 1, so a sign is rejected up front
+    uint64_t uint64Arg(size_t index) const {
+        return numberArg(index, [](const string& token, size_t* used) -> uint64_t {
+            if (token.find('-') != string::npos) throw invalid_argument(token);
+            return stoull(token, used);
+        });
+    }
+
+    double doubleArg(size_t index) const {
+        return numberArg(index, [](const string& token, size_t* used) { return stod(token, used); });
+    }
+
+    static void displayStats() {
+        LatencyMetrics& metrics = latencyMetrics();
+        double seconds = metrics.secondsSinceReset();
+        cout << "\n=== Latency (us) over " << fixed << setprecision(1) << seconds << " s ===\n";
+        cout << left << setw(10) << "Metric" << right << setw(12) << "Count" << setw(12) << "Ops/s"
+             << setw(10) << "p50" << setw(10) << "p99" << setw(10) << "p999" << setw(10) << "Max" << "\n";
+        for (int m = 0; m < LatencyMetrics::METRICS; ++m) {
+            LatencyMetrics::Summary summary = metrics.summarize((Metric)m);
+            cout << left << setw(10) << LatencyMetrics::name((Metric)m) << right << setw(12) << summary.count
+                 << setprecision(0) << setw(12) << (seconds > 0 ? summary.count / seconds : 0.0) << setprecision(2)
+                 << setw(10) << summary.p50 / 1000 << setw(10) << summary.p99 / 1000 << setw(10) << summary.p999 / 1000
+                 << setw(10) << summary.max / 1000 << "\n";
+        }
+        cout << left;
+    }
+
+    // Returns false when the script asks to stop
+    bool execute() {
+        const string& command = tokens[0];
+
+        if (command == "market") {
+            market.displayMarketStatus();
+        } else if (command == "news") {
+            market.displayMarketNews();
+        } else if (command == "create") {
+            if (tokens.size() > 2) {
+                portfolioManager.createPortfolio(arg(1), doubleArg(2));
+            } else {
+                portfolioManager.createPortfolio(arg(1));
+            }
+        } else if (command == "select") {
+            portfolioManager.selectPortfolio(arg(1));
+        } else if (command == "portfolios") {
+            portfolioManager.displayPortfolios();
+        } else if (command == "buy") {
+            Stock& stock = market.getStock(arg(1));
+            portfolioManager.buyStock(stock, intArg(2, 1));
+        } else if (command == "sell") {
+            Stock& stock = market.getStock(arg(1));
+            portfolioManager.sellStock(stock, intArg(2, 1));
+        } else if (command == "transactions") {
+            Portfolio& portfolio = portfolioManager.getCurrentPortfolio();
+            if (tokens.size() > 1) {
+                int64_t from = tokens.size() > 2 ? longArg(2) : numeric_limits<int64_t>::min();
+                int64_t to = tokens.size() > 3 ? longArg(3) : numeric_limits<int64_t>::max();
+                portfolio.displayTransactionHistory(symbolTable().find(arg(1)), from, to);
+            } else {
+                portfolio.displayTransactionHistory();
+            }
+        } else if (command == "save") {
+            snapshots.save(arg(1), market, portfolioManager);
+        } else if (command == "load") {
+            snapshots.load(arg(1), market, portfolioManager);
+        } else if (command == "replay") {
+            TickReplayer::Result result = TickReplayer::replay(arg(1), market, tokens.size() > 2 ? doubleArg(2) : 0.0);
+            portfolioManager.revalue(market);
+            cout << "Replayed " << result.ticks << " ticks in " << fixed << setprecision(3) << result.seconds << " s";
+            if (result.seconds > 0) {
+                cout << " (" << setprecision(0) << result.ticks / result.seconds << " ticks/s)";
+            }
+            cout << ", skipped " << result.skipped << " lines\n";
+        } else if (command == "tickconvert") {
+            cout << "Converted " << TickReplayer::convertCsvToBinary(arg(1), arg(2)) << " ticks\n";
+        } else if (command == "journal") {
+            portfolioManager.setJournalDirectory(tokens.size() > 1 ? arg(1) : "");
+        } else if (command == "valuations") {
+            portfolioManager.revalue(market);
+            portfolioManager.displayValuations(tokens.size() > 1 ? intArg(1) : 20);
+        } else if (command == "revalue") {
+            // revalue [resync]: parallel full revaluation checked against the incremental values
+            auto start = chrono::steady_clock::now();
+            double difference = portfolioManager.fullRevalue(market, tokens.size() > 1 && tokens[1] == "resync");
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            cout << "Full revalue of " << portfolioManager.size() << " portfolios in " << fixed << setprecision(2)
+                 << ms << " ms, max difference $" << setprecision(6) << difference << "\n";
+        } else if (command == "portfoliogen") {
+            // portfoliogen COUNT POSITIONS
+            portfolioManager.generatePortfolios(market, intArg(1), intArg(2));
+        } else if (command == "stress") {
+            // stress CLIENTS OPS: concurrent clients trading while the market ticks
+            StressTest::Result result = StressTest::run(market, portfolioManager, intArg(1), intArg(2));
+            cout << "Stress: " << result.operations << " operations (" << result.trades << " trades) in "
+                 << fixed << setprecision(3) << result.seconds << " s, " << setprecision(0)
+                 << (result.seconds > 0 ? result.operations / result.seconds : 0.0) << " ops/s, "
+                 << result.ticks << " market ticks, shares " << (result.conserved ? "conserved" : "NOT conserved") << "\n";
+            if (!result.conserved) throw runtime_error("Share accounting mismatch");
+        } else if (command == "stats") {
+            // stats [reset]: merged latency percentiles; the market keeps running
+            if (tokens.size() > 1 && tokens[1] == "reset") {
+                latencyMetrics().reset();
+            } else {
+                displayStats();
+            }
+        } else if (command == "export") {
+            // export market|history|trades FILE [csv|columnar]
+            const string& what = arg(1);
+            BulkExporter::Format format = BulkExporter::Format::Csv;
+            if (tokens.size() > 3) {
+                if (tokens[3] == "columnar") format = BulkExporter::Format::Columnar;
+                else if (tokens[3] != "csv") throw runtime_error("Format must be csv or columnar");
+            }
+            BulkExporter::Result result;
+            if (what == "market") result = BulkExporter::exportMarket(arg(2), market, format);
+            else if (what == "history") result = BulkExporter::exportHistory(arg(2), market, format);
+            else if (what == "trades") result = BulkExporter::exportTrades(arg(2), portfolioManager, market.getWorkerPool(), format);
+            else throw runtime_error("Export market, history or trades");
+            cout << "Exported " << result.rows << " rows (" << result.bytes << " bytes) in " << fixed
+                 << setprecision(3) << result.seconds << " s";
+            if (result.seconds > 0) {
+                cout << ", " << setprecision(0) << result.bytes / result.seconds / 1e6 << " MB/s";
+            }
+            cout << "\n";
+        } else if (command == "var") {
+            // var PATHS HORIZON [CONFIDENCE] [SEED] for the selected portfolio
+            double confidence = tokens.size() > 3 ? doubleArg(3) : 0.99;
+            if (!(confidence > 0.0 && confidence < 1.0)) throw runtime_error("Confidence must be between 0 and 1");
+            int paths = intArg(1, 1);
+            int horizon = intArg(2, 1);
+            RiskEngine::Result result = RiskEngine::simulate(portfolioManager.getCurrentPortfolio(), market, paths,
+                                                             horizon, tokens.size() > 4 ? uint64Arg(4) : 1);
+            RiskEngine::display(result, confidence, horizon);
+        } else if (command == "backtest") {
+            // backtest [SYMBOLS] [TICKS] [TOP]: the default strategy grid over the retained history
+            PriceTape tape(market, tokens.size() > 1 ? intArg(1) : 100, tokens.size() > 2 ? intArg(2) : 0);
+            vector<unique_ptr<Strategy>> strategies = Backtester::parameterGrid();
+            Backtester::Summary summary = Backtester::run(tape, strategies, 1e6, market.getWorkerPool());
+            Backtester::display(summary, tape, tokens.size() > 3 ? intArg(3) : 10);
+        } else if (command == "rate") {
+            // rate SYM|all TICKS_PER_SECOND (0 = idle)
+            if (arg(1) == "all") {
+                for (size_t i = 0; i < market.size(); ++i) scheduler.setTickRate(market.getStockAt(i).getId(), doubleArg(2));
+            } else {
+                scheduler.setTickRate(market.getStock(arg(1)).getId(), doubleArg(2));
+            }
+        } else if (command == "at") {
+            // at MS order SYM buy|sell QTY PRICE | at MS alert SYM above|below PRICE [EVERY_MS]
+            // | at MS snapshot FILE [EVERY_MS]   (MS from the current simulated time)
+            int64_t delay = (int64_t)(doubleArg(1) * 1000);
+            const string& kind = arg(2);
+            if (kind == "order") {
+                if (arg(4) != "buy" && arg(4) != "sell") throw runtime_error("Side must be 'buy' or 'sell'");
+                scheduler.scheduleOrder(delay, market.getStock(arg(3)).getId(), arg(4) == "buy", intArg(5), doubleArg(6));
+            } else if (kind == "alert") {
+                if (arg(4) != "above" && arg(4) != "below") throw runtime_error("Alert must be 'above' or 'below'");
+                scheduler.scheduleAlert(delay, market.getStock(arg(3)).getId(), arg(4) == "above", doubleArg(5),
+                                        tokens.size() > 6 ? (int64_t)(doubleArg(6) * 1000) : 0);
+            } else if (kind == "snapshot") {
+                scheduler.scheduleSnapshot(delay, arg(3), tokens.size() > 4 ? (int64_t)(doubleArg(4) * 1000) : 0);
+            } else {
+                throw runtime_error("Schedule an order, alert or snapshot");
+            }
+        } else if (command == "run") {
+            // run MS [SPEED]: advance the simulated clock; SPEED 0 = as fast as possible, 1 = real time
+            MarketScheduler::RunResult result = scheduler.run((int64_t)(doubleArg(1) * 1000), tokens.size() > 2 ? doubleArg(2) : 0.0);
+            cout << "Clock at " << fixed << setprecision(3) << scheduler.getTime() / 1000.0 << " ms: " << result.symbolTicks
+                 << " symbol ticks, " << result.otherEvents << " other events in " << result.seconds << " s";
+            if (result.seconds > 0) cout << " (" << setprecision(0) << result.symbolTicks / result.seconds << " ticks/s)";
+            cout << ", " << scheduler.pendingEvents() << " pending\n";
+        } else if (command == "summary") {
+            portfolioManager.getCurrentPortfolio().displayPortfolioSummary();
+        } else if (command == "search") {
+            market.searchStock(arg(1));
+        } else if (command == "find" || command == "fuzzy") {
+            // find PREFIX [K] [name|price|change|volume]
+            // fuzzy QUERY [K] [MAXEDITS] [price|change|volume]
+            size_t k = tokens.size() > 2 ? (size_t)intArg(2, 0) : 10;
+            size_t keyArg = command == "find" ? 3 : 4;
+            string key = tokens.size() > keyArg ? arg(keyArg) : (command == "find" ? "name" : "price");
+            RankKey rank = RankKey::Price;
+            if (key == "change") rank = RankKey::PercentChange;
+            else if (key == "volume") rank = RankKey::Volume;
+            else if (key != "price" && !(key == "name" && command == "find")) {
+                throw runtime_error("Rank key must be " + string(command == "find" ? "name, " : "") + "price, change or volume");
+            }
+            market.getSearchIndex();  // a pending rebuild is not part of the query time
+            auto start = chrono::steady_clock::now();
+            vector<SymbolIndex::Match> matches = command == "find"
+                ? market.searchPrefix(arg(1), k, rank, key != "name")
+                : market.searchFuzzy(arg(1), k, tokens.size() > 3 ? intArg(3, 0) : 2, rank);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            market.displaySearchResults((command == "find" ? "Prefix " : "Fuzzy ") + arg(1), matches, seconds);
+        } else if (command == "history") {
+            int count = tokens.size() > 2 ? intArg(2) : 10;
+            market.getStock(arg(1)).displayPriceHistory(count);
+        } else if (command == "historyrange") {
+            // historyrange SYM [FIRST COUNT]: stats over kept prices (0 = oldest kept)
+            long long first = tokens.size() > 2 ? longArg(2) : 0;
+            long long count = tokens.size() > 3 ? longArg(3) : numeric_limits<long long>::max();
+            if (first < 0 || count < 0) throw runtime_error("historyrange needs a non-negative FIRST and COUNT");
+            market.getStock(arg(1)).displayHistoryRange(first, count);
+        } else if (command == "historycheck") {
+            // historycheck [COUNT] [SEED]: round-trips generated prices through both codecs
+            size_t count = tokens.size() > 1 ? intArg(1, 1) : 100000;
+            uint64_t seed = tokens.size() > 2 ? uint64Arg(2) : 1;
+            for (CompressedPrices::Mode mode : {CompressedPrices::Mode::Lossless, CompressedPrices::Mode::Cents}) {
+                const char* name = mode == CompressedPrices::Mode::Lossless ? "lossless" : "cents";
+                long long bad = CompressedPrices::roundTripCheck(mode, count, seed);
+                if (bad >= 0) {
+                    throw runtime_error(string("Codec ") + name + " failed the round trip at price " + to_string(bad));
+                }
+                cout << "Codec " << name << ": " << count << " prices round-trip\n";
+            }
+        } else if (command == "historycompress") {
+            // historycompress lossless|cents: keep evicted prices compressed in memory
+            if (arg(1) == "lossless") market.compressHistories(CompressedPrices::Mode::Lossless);
+            else if (arg(1) == "cents") market.compressHistories(CompressedPrices::Mode::Cents);
+            else throw runtime_error("Compression must be lossless or cents");
+        } else if (command == "historymem") {
+            market.displayHistoryMemory();
+        } else if (command == "historyconfig") {
+            // historyconfig CAPACITY WINDOW [prealloc] [SPILLDIR]
+            bool preallocate = false;
+            string spillDirectory;
+            for (size_t i = 3; i < tokens.size(); ++i) {
+                if (tokens[i] == "prealloc") preallocate = true;
+                else spillDirectory = tokens[i];
+            }
+            market.configureHistory(intArg(1, 1), intArg(2, 1), spillDirectory, preallocate);
+        } else if (command == "allocs") {
+            // allocs TICKS [assert]: global allocations per market tick
+            if (allocationCount() < 0) {
+                throw runtime_error("Allocation counting is off; build with -DSTONKS_COUNT_ALLOCATIONS");
+            }
+            int ticks = intArg(1);
+            latencyMetrics().registerThread();  // one-time per-thread setup is not a per-tick cost
+            long long before = allocationCount();
+            for (int i = 0; i < ticks; ++i) {
+                market.updateMarket();
+            }
+            long long allocations = allocationCount() - before;
+            cout << allocations << " allocations over " << ticks << " ticks ("
+                 << fixed << setprecision(3) << (ticks > 0 ? (double)allocations / ticks : 0.0) << " per tick)\n";
+            if (tokens.size() > 2 && tokens[2] == "assert" && allocations != 0) {
+                throw runtime_error("Tick path allocated");
+            }
+        } else if (command == "advance") {
+            int ticks = tokens.size() > 1 ? intArg(1) : 1;
+            for (int i = 0; i < ticks; ++i) {
+                market.updateMarket();
+                portfolioManager.revalue(market);
+            }
+        } else if (command == "top") {
+            if (tokens.size() > 2) {
+                const string& key = arg(2);
+                if (key == "price") market.setRankKey(RankKey::Price);
+                else if (key == "change") market.setRankKey(RankKey::PercentChange);
+                else if (key == "volume") market.setRankKey(RankKey::Volume);
+                else throw runtime_error("Rank key must be price, change or volume");
+            }
+            market.displayTopStocks(intArg(1));
+        } else if (command == "limit") {
+            const string& side = arg(2);
+            if (side != "buy" && side != "sell") {
+                throw runtime_error("Side must be 'buy' or 'sell'");
+            }
+            Stock& stock = market.getStock(arg(1));
+            long long id = market.submitOrder(arg(1), side == "buy", intArg(3), doubleArg(4));
+            const auto& fills = stock.getOrderBook().getFills();
+            int filled = 0;
+            for (const auto& trade : fills) filled += trade.quantity;
+            cout << "Order " << id << ": " << filled << " filled in " << fills.size()
+                 << " trades, last price $" << fixed << setprecision(2) << stock.getCurrentPrice() << "\n";
+        } else if (command == "cancel") {
+            bool cancelled = market.getStock(arg(1)).cancelOrder(longArg(2));
+            cout << (cancelled ? "Order cancelled.\n" : "Order not found.\n");
+        } else if (command == "book") {
+            market.getStock(arg(1)).displayOrderBook(tokens.size() > 2 ? intArg(2) : 5);
+        } else if (command == "universe") {
+            market.generateUniverse(intArg(1, 0));
+        } else if (command == "threads") {
+            market.setThreads(intArg(1, 1));
+        } else if (command == "seed") {
+            market.setSeed(uint64Arg(1));
+        } else if (command == "relate") {
+            market.addStockRelationship(arg(1), arg(2), tokens.size() > 3 ? doubleArg(3) : 1.0);
+        } else if (command == "correlate") {
+            // correlate WINDOW [MAXSTOCKS]
+            market.trackCorrelations(intArg(1, 1), tokens.size() > 2 ? intArg(2, 0) : 0);
+        } else if (command == "corr") {
+            cout << "Correlation " << arg(1) << "/" << arg(2) << ": " << fixed << setprecision(4)
+                 << market.correlation(arg(1), arg(2)) << "\n";
+        } else if (command == "corrgraph") {
+            cout << "Linked " << market.linkCorrelated(doubleArg(1)) << " correlated pairs\n";
+        } else if (command == "graphgen") {
+            market.generateRelationships(longArg(1));
+        } else if (command == "reach") {
+            // reach SYM [DEPTH] [MINWEIGHT]: contagion spread from one symbol
+            auto start = chrono::steady_clock::now();
+            vector<int> depth = market.getGraph().bfs(market.getStock(arg(1)).getId(),
+                tokens.size() > 2 ? intArg(2) : numeric_limits<int>::max(),
+                tokens.size() > 3 ? doubleArg(3) : 0.0, market.getWorkerPool());
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            vector<long long> perLevel;
+            for (int d : depth) {
+                if (d < 0) continue;
+                if (d >= (int)perLevel.size()) perLevel.resize(d + 1, 0);
+                perLevel[d]++;
+            }
+            long long reached = 0;
+            for (size_t d = 1; d < perLevel.size(); ++d) reached += perLevel[d];
+            cout << "Reach from " << arg(1) << ": " << reached << " symbols";
+            for (size_t d = 1; d < perLevel.size(); ++d) cout << (d == 1 ? " (" : ", ") << "hop " << d << ": " << perLevel[d];
+            cout << (perLevel.size() > 1 ? ")" : "") << " in " << fixed << setprecision(3) << ms << " ms\n";
+        } else if (command == "neighbors") {
+            vector<SymbolId> found = market.getGraph().kHopNeighbors(market.getStock(arg(1)).getId(),
+                tokens.size() > 2 ? intArg(2) : 1, market.getWorkerPool());
+            cout << found.size() << " symbols within " << (tokens.size() > 2 ? intArg(2) : 1) << " hops of " << arg(1) << ":";
+            for (size_t i = 0; i < found.size() && i < 50; ++i) cout << " " << symbolTable().name(found[i]);
+            cout << (found.size() > 50 ? " ...\n" : "\n");
+        } else if (command == "clusters") {
+            // clusters [MINSIZE]: connected components of the relationship graph
+            size_t minSize = tokens.size() > 1 ? intArg(1) : 2;
+            auto start = chrono::steady_clock::now();
+            vector<SymbolId> labels = market.getGraph().connectedComponents(market.getWorkerPool());
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            map<SymbolId, size_t> sizes;
+            for (SymbolId v = 0; v < labels.size(); ++v) {
+                if (market.getGraph().degree(v) > 0) sizes[labels[v]]++;
+            }
+            size_t shown = 0;
+            cout << "\n=== Clusters ===\n";
+            for (const auto& cluster : sizes) {
+                if (cluster.second < minSize) continue;
+                if (shown++ < 20) cout << symbolTable().name(cluster.first) << " cluster: " << cluster.second << " symbols\n";
+            }
+            cout << shown << " clusters of " << minSize << "+ symbols, found in " << fixed << setprecision(3) << ms << " ms\n";
+        } else if (command == "relations") {
+            market.displayStockRelationships();
+        } else if (command == "exit" || command == "quit") {
+            return false;
+        } else {
+            throw runtime_error("Unknown command '" + command + "'");
+        }
+        return true;
+    }
+
+public:
+    BatchRunner(StockMarket& m, PortfolioManager& pm) :
+        market(m), portfolioManager(pm), scheduler(m, pm, snapshots), commandsExecuted(0), commandErrors(0) {}
+
+    void run(istream& in) {
+        auto start = chrono::steady_clock::now();
+        string line;
+        long long lineNumber = 0;
+
+        while (getline(in, line)) {
+            lineNumber++;
+            tokenize(line);
+            if (tokens.empty()) continue;
+
+            commandsExecuted++;
+            try {
+                if (!execute()) break;
+            } catch (const runtime_error& e) {
+                commandErrors++;
+                cout << "Error (line " << lineNumber << "): " << e.what() << "\n";
+            }
+        }
+        cout.flush();
+
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cerr << "Batch: " << commandsExecuted << " commands (" << commandErrors << " errors) in "
+             << fixed << setprecision(3) << seconds << " s";
+        if (seconds > 0) {
+            cerr << ", " << setprecision(0) << commandsExecuted / seconds << " commands/s";
+        }
+        cerr << "\n";
+    }
+};
+
+#ifdef __linux__
+// Socket Server
+// Stonks --serve unix:PATH|tcp:PORT [--tick MS] serves the market from one
+// epoll loop over non-blocking sockets (TCP binds to loopback only). Frames
+// are little-endian and strings are u32 length + bytes, as in snapshots:
+//   request:  u32 bodyLength, u8 opcode, u32 requestId, payload
+//   response: u32 bodyLength, u8 opcode, u32 requestId, u8 status, payload
+// Clients may pipeline any number of requests: every complete request in a
+// read is answered and the replies go out in one write. A timerfd ticks the
+// market every --tick ms (0 = never) and each subscriber then receives one
+// PUSH_TICK frame with its symbols' prices.
+//   QUOTE     sym                        -> f64 price, f64 open, i64 volume, i32 available
+//   BUY/SELL  portfolio, sym, i32 shares -> f64 price, f64 cash
+//   TOP       u16 n, u8 key (0 price, 1 change, 2 volume) -> u16 count, (sym, f64 value)*
+//   HISTORY   sym, u16 count             -> u16 count, f64 prices (latest first)
+//   SUBSCRIBE sym ("" = every stock)     -> empty
+//   CREATE    portfolio, f64 cash        -> empty
+//   PUSH_TICK (server to client, id 0)   -> i64 tick, u32 count, (sym, f64 price)*
+// A failed request answers status 1 with an error string.
+enum ServerOpcode : uint8_t { QUOTE = 1, BUY, SELL, TOP, HISTORY, SUBSCRIBE, CREATE, PUSH_TICK = 0x40 };
+
+// Frame helpers shared by the server and the load-test client
+inline size_t beginFrame(SnapshotWriter& out, uint8_t opcode, uint32_t requestId) {
+    size_t start = out.data().size();
+    out.put<uint32_t>(0);
+    out.put<uint8_t>(opcode);
+    out.put<uint32_t>(requestId);
+    return start;
+}
+
+inline void endFrame(SnapshotWriter& out, size_t start) {
+    uint32_t length = (uint32_t)(out.data().size() - start - sizeof(uint32_t));
+    memcpy(&out.data()[start], &length, sizeof(length));
+}
+
+// Parses "unix:PATH" or "tcp:PORT" into a socket address
+inline socklen_t parseAddress(const string& address, sockaddr_storage& storage) {
+    memset(&storage, 0, sizeof(storage));
+    if (address.compare(0, 5, "unix:") == 0) {
+        sockaddr_un* local = (sockaddr_un*)&storage;
+        string path = address.substr(5);
+        if (path.size() >= sizeof(local->sun_path)) throw runtime_error("Socket path too long");
+        local->sun_family = AF_UNIX;
+        memcpy(local->sun_path, path.c_str(), path.size() + 1);
+        return sizeof(sockaddr_un);
+    }
+    if (address.compare(0, 4, "tcp:") == 0) {
+        sockaddr_in* inet = (sockaddr_in*)&storage;
+        inet->sin_family = AF_INET;
+        inet->sin_port = htons((uint16_t)stoi(address.substr(4)));
+        inet->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return sizeof(sockaddr_in);
+    }
+    throw runtime_error("Address must be unix:PATH or tcp:PORT");
+}
+
+class MarketServer {
+private:
+    // Beyond MAX_PENDING_OUTPUT unsent bytes a client is not read (so it gets
+    // no new replies) and misses tick pushes until it drains its socket
+    static constexpr size_t MAX_PENDING_OUTPUT = 64 << 20;
+    static constexpr uint32_t MAX_FRAME = 64 << 10;  // larger frames close the connection
+    static constexpr uint32_t READ_EVENTS = EPOLLIN | EPOLLRDHUP;
+
+    struct Connection {
+        int fd;
+        vector<char> input;
+        size_t consumed = 0;
+        SnapshotWriter output;
+        size_t sent = 0;
+        uint32_t events = READ_EVENTS;
+        bool subscribedAll = false;
+        vector<SymbolId> subscriptions;
+    };
+
+    StockMarket& market;
+    PortfolioManager& portfolioManager;
+    int listenFd;
+    int epollFd;
+    int timerFd;
+    string unixPath;
+    unordered_map<int, unique_ptr<Connection>> connections;
+    long long ticks;
+    long long requests;
+    long long droppedPushes;
+
+    static volatile sig_atomic_t stopRequested;
+    static void requestStop(int) { stopRequested = 1; }
+
+    void watch(int fd, uint32_t events, int operation) {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        if (epoll_ctl(epollFd, operation, fd, &event) != 0) throw runtime_error("epoll_ctl failed");
+    }
+
+    void acceptClients() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;  // EAGAIN: no more pending connections
+            if (unixPath.empty()) {
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            }
+            unique_ptr<Connection> connection(new Connection());
+            connection->fd = fd;
+            watch(fd, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_ADD);
+            connections[fd] = move(connection);
+        }
+    }
+
+    void closeConnection(Connection& connection) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, connection.fd, nullptr);
+        close(connection.fd);
+        connections.erase(connection.fd);
+    }
+
+    static size_t pendingOutput(Connection& connection) {
+        return connection.output.data().size() - connection.sent;
+    }
+
+    // Returns false when the peer is gone
+    bool flush(Connection& connection) {
+        vector<char>& bytes = connection.output.data();
+        while (connection.sent < bytes.size()) {
+            ssize_t n = send(connection.fd, bytes.data() + connection.sent, bytes.size() - connection.sent, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                return false;
+            }
+            connection.sent += n;
+        }
+        if (connection.sent == bytes.size()) {
+            bytes.clear();
+            connection.sent = 0;
+        } else if (connection.sent > bytes.size() / 2) {
+            bytes.erase(bytes.begin(), bytes.begin() + connection.sent);
+            connection.sent = 0;
+        }
+        uint32_t events = (pendingOutput(connection) <= MAX_PENDING_OUTPUT ? READ_EVENTS : 0) |
+                          (bytes.empty() ? 0U : (uint32_t)EPOLLOUT);
+        if (events != connection.events) {
+            watch(connection.fd, events, EPOLL_CTL_MOD);
+            connection.events = events;
+        }
+        return true;
+    }
+
+    void handleRequest(Connection& connection, uint8_t opcode, uint32_t requestId, SnapshotReader& in) {
+        ScopedLatency latency(Metric::Request);
+        SnapshotWriter& out = connection.output;
+        size_t frame = beginFrame(out, opcode, requestId);
+        try {
+            out.put<uint8_t>(0);
+            switch (opcode) {
+                case QUOTE: {
+                    const Stock& stock = market.getStock(in.getString());
+                    out.put<double>(stock.getCurrentPrice());
+                    out.put<double>(stock.getOpenPrice());
+                    out.put<int64_t>(stock.getVolume());
+                    out.put<int32_t>(stock.getAvailableShares());
+                    break;
+                }
+                case BUY:
+                case SELL: {
+                    PortfolioHandle handle = portfolioManager.find(in.getString());
+                    Stock& stock = market.getStock(in.getString());
+                    int shares = in.get<int32_t>();
+                    if (shares <= 0) throw runtime_error("Share count must be positive");
+                    if (opcode == BUY) portfolioManager.buyStock(handle, stock, shares);
+                    else portfolioManager.sellStock(handle, stock, shares);
+                    out.put<double>(stock.getCurrentPrice());
+                    out.put<double>(portfolioManager.cashOf(handle));
+                    break;
+                }
+                case TOP: {
+                    ScopedLatency topLatency(Metric::TopN);
+                    int n = in.get<uint16_t>();
+                    uint8_t key = in.get<uint8_t>();
+                    if (key > 2) throw runtime_error("Unknown rank key");
+                    auto top = market.topStocksBy(n, key == 0 ? RankKey::Price : key == 1 ? RankKey::PercentChange : RankKey::Volume);
+                    out.put<uint16_t>((uint16_t)top.size());
+                    for (const auto& entry : top) {
+                        out.putString(symbolTable().name(entry.first));
+                        out.put<double>(entry.second);
+                    }
+                    break;
+                }
+                case HISTORY: {
+                    ScopedLatency historyLatency(Metric::History);
+                    const PriceHistory& history = market.getStock(in.getString()).getHistory();
+                    size_t count = min<size_t>(in.get<uint16_t>(), history.size());
+                    out.put<uint16_t>((uint16_t)count);
+                    for (size_t age = 0; age < count; ++age) out.put<double>(history.at(age));
+                    break;
+                }
+                case SUBSCRIBE: {
+                    string symbol = in.getString();
+                    if (symbol.empty()) connection.subscribedAll = true;
+                    else connection.subscriptions.push_back(market.getStock(symbol).getId());
+                    break;
+                }
+                case CREATE: {
+                    string name = in.getString();
+                    double cash = in.get<double>();
+                    if (!(cash >= 0.0 && cash < numeric_limits<double>::infinity())) {
+                        throw runtime_error("Starting cash must be a non-negative amount");
+                    }
+                    portfolioManager.createPortfolio(name, cash, true);
+                    break;
+                }
+                default:
+                    throw runtime_error("Unknown opcode");
+            }
+        } catch (const runtime_error& e) {
+            out.data().resize(frame);
+            frame = beginFrame(out, opcode, requestId);
+            out.put<uint8_t>(1);
+            out.putString(e.what());
+        }
+        endFrame(out, frame);
+        requests++;
+    }
+
+    // Answers buffered complete requests until the reply backlog is full;
+    // false on a malformed or oversized frame
+    bool answer(Connection& connection) {
+        vector<char>& input = connection.input;
+        while (input.size() - connection.consumed >= sizeof(uint32_t) && pendingOutput(connection) <= MAX_PENDING_OUTPUT) {
+            uint32_t length;
+            memcpy(&length, input.data() + connection.consumed, sizeof(length));
+            if (length < 5 || length > MAX_FRAME) return false;
+            if (input.size() - connection.consumed - sizeof(uint32_t) < length) break;
+            const char* body = input.data() + connection.consumed + sizeof(uint32_t);
+            SnapshotReader in(body, length);
+            uint8_t opcode = in.get<uint8_t>();
+            uint32_t requestId = in.get<uint32_t>();
+            handleRequest(connection, opcode, requestId, in);
+            connection.consumed += sizeof(uint32_t) + length;
+        }
+        if (connection.consumed == input.size()) {
+            input.clear();
+            connection.consumed = 0;
+        } else if (connection.consumed > input.size() / 2) {
+            input.erase(input.begin(), input.begin() + connection.consumed);
+            connection.consumed = 0;
+        }
+        return true;
+    }
+
+    // Reads and answers a chunk at a time, so buffered input stays under one
+    // frame plus one chunk; stops reading while the reply backlog is full.
+    // Returns false when the peer is gone or broke the protocol.
+    bool serve(Connection& connection) {
+        char chunk[64 << 10];
+        bool open = answer(connection);
+        while (open && pendingOutput(connection) <= MAX_PENDING_OUTPUT) {
+            ssize_t n = read(connection.fd, chunk, sizeof(chunk));
+            if (n > 0) {
+                connection.input.insert(connection.input.end(), chunk, chunk + n);
+                open = answer(connection);
+                continue;
+            }
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) open = false;
+            break;
+        }
+        return flush(connection) && open;
+    }
+
+    void tick() {
+        uint64_t expirations;
+        if (read(timerFd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+        market.updateMarket();
+        portfolioManager.revalue(market);
+        ticks++;
+
+        vector<Connection*> gone;
+        for (auto& entry : connections) {
+            Connection& connection = *entry.second;
+            if (!connection.subscribedAll && connection.subscriptions.empty()) continue;
+            if (pendingOutput(connection) > MAX_PENDING_OUTPUT) {
+                droppedPushes++;
+                continue;
+            }
+            SnapshotWriter& out = connection.output;
+            size_t frame = beginFrame(out, PUSH_TICK, 0);
+            out.put<uint8_t>(0);
+            out.put<int64_t>(ticks);
+            if (connection.subscribedAll) {
+                out.put<uint32_t>((uint32_t)market.size());
+                for (size_t i = 0; i < market.size(); ++i) {
+                    const Stock& stock = market.getStockAt(i);
+                    out.putString(stock.getSymbol());
+                    out.put<double>(stock.getCurrentPrice());
+                }
+            } else {
+                out.put<uint32_t>((uint32_t)connection.subscriptions.size());
+                for (SymbolId symbol : connection.subscriptions) {
+                    out.putString(symbolTable().name(symbol));
+                    out.put<double>(market.getStock(symbol).getCurrentPrice());
+                }
+            }
+            endFrame(out, frame);
+            if (!flush(connection)) gone.push_back(&connection);
+        }
+        for (Connection* connection : gone) closeConnection(*connection);
+    }
+
+public:
+    MarketServer(StockMarket& m, PortfolioManager& pm) :
+        market(m), portfolioManager(pm), listenFd(-1), epollFd(-1), timerFd(-1), ticks(0), requests(0), droppedPushes(0) {}
+
+    ~MarketServer() {
+        for (auto& entry : connections) close(entry.first);
+        if (timerFd != -1) close(timerFd);
+        if (epollFd != -1) close(epollFd);
+        if (listenFd != -1) close(listenFd);
+        if (!unixPath.empty()) unlink(unixPath.c_str());
+    }
+
+    void listen(const string& address) {
+        sockaddr_storage storage;
+        socklen_t length = parseAddress(address, storage);
+        listenFd = socket(storage.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0) throw runtime_error("Cannot create socket");
+        if (storage.ss_family == AF_UNIX) {
+            unixPath = address.substr(5);
+            unlink(unixPath.c_str());
+        } else {
+            int one = 1;
+            setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        }
+        if (bind(listenFd, (sockaddr*)&storage, length) != 0 || ::listen(listenFd, 1024) != 0) {
+            throw runtime_error("Cannot listen on " + address);
+        }
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd < 0) throw runtime_error("epoll_create1 failed");
+        watch(listenFd, EPOLLIN, EPOLL_CTL_ADD);
+    }
+
+    // Serves until SIGINT or SIGTERM
+    void run(int tickMillis) {
+        if (tickMillis > 0) {
+            timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            itimerspec interval{};
+            interval.it_interval.tv_sec = tickMillis / 1000;
+            interval.it_interval.tv_nsec = (tickMillis % 1000) * 1000000L;
+            interval.it_value = interval.it_interval;
+            if (timerFd < 0 || timerfd_settime(timerFd, 0, &interval, nullptr) != 0) {
+                throw runtime_error("Cannot start the tick timer");
+            }
+            watch(timerFd, EPOLLIN, EPOLL_CTL_ADD);
+        }
+        stopRequested = 0;
+        signal(SIGINT, requestStop);
+        signal(SIGTERM, requestStop);
+
+        auto start = chrono::steady_clock::now();
+        epoll_event events[256];
+        while (!stopRequested) {
+            int ready = epoll_wait(epollFd, events, 256, 200);
+            for (int i = 0; i < ready; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == listenFd) {
+                    acceptClients();
+                } else if (fd == timerFd) {
+                    tick();
+                } else {
+                    auto it = connections.find(fd);
+                    if (it == connections.end()) continue;
+                    Connection& connection = *it->second;
+                    bool open = true;
+                    bool paused = !(connection.events & EPOLLIN);
+                    if (events[i].events & EPOLLOUT) open = flush(connection);
+                    // Resuming after a full backlog also answers requests buffered meanwhile
+                    bool resumed = paused && (connection.events & EPOLLIN);
+                    if (open && (resumed || (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))) {
+                        open = serve(connection);
+                    }
+                    if (!open) closeConnection(connection);
+                }
+            }
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cerr << "Server: " << requests << " requests, " << ticks << " ticks in " << fixed << setprecision(1) << seconds << " s, "
+             << droppedPushes << " pushes dropped\n";
+    }
+};
+
+volatile sig_atomic_t MarketServer::stopRequested = 0;
+
+// Load-Test Client
+// Stonks --loadtest ADDRESS CLIENTS REQUESTS [DEPTH] opens CLIENTS
+// connections, each keeping DEPTH requests in flight (80% quotes, 10%
+// history, 10% top-N over the default symbols) until it has sent REQUESTS.
+// Round-trip latencies go to the request histogram; the report shows
+// requests/s and p50/p99/p999.
+class LoadTest {
+private:
+    static void client(const string& address, long long requests, int depth, atomic<long long>& failures) {
+        sockaddr_storage storage;
+        socklen_t length = parseAddress(address, storage);
+        int fd = socket(storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || connect(fd, (sockaddr*)&storage, length) != 0) {
+            if (fd >= 0) close(fd);
+            failures += requests;
+            return;
+        }
+        if (storage.ss_family == AF_INET) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+
+        static const char* symbols[] = {"AAPL", "GOOG", "MSFT", "AMZN", "TSLA"};
+        vector<chrono::steady_clock::time_point> sentAt(depth);
+        long long sent = 0, received = 0;
+        uint32_t state = mixBits((uint32_t)fd + 7);
+        SnapshotWriter out;
+        auto queue = [&](long long count) {
+            for (long long i = 0; i < count && sent < requests; ++i, ++sent) {
+                uint32_t draw = mixBits(state += 0x9E3779B9U);
+                uint8_t opcode = draw % 10 < 8 ? QUOTE : draw % 10 == 8 ? HISTORY : TOP;
+                size_t frame = beginFrame(out, opcode, (uint32_t)sent);
+                if (opcode == TOP) {
+                    out.put<uint16_t>(5);
+                    out.put<uint8_t>(0);
+                } else {
+                    out.putString(symbols[(draw >> 8) % 5]);
+                    if (opcode == HISTORY) out.put<uint16_t>(10);
+                }
+                endFrame(out, frame);
+                sentAt[sent % depth] = chrono::steady_clock::now();
+            }
+            const vector<char>& bytes = out.data();
+            for (size_t offset = 0; offset < bytes.size();) {
+                ssize_t n = send(fd, bytes.data() + offset, bytes.size() - offset, MSG_NOSIGNAL);
+                if (n <= 0) return false;
+                offset += n;
+            }
+            out.data().clear();
+            return true;
+        };
+
+        vector<char> input;
+        size_t consumed = 0;
+        char chunk[64 << 10];
+        bool ok = queue(depth);
+        while (ok && received < sent) {
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if (n <= 0) break;
+            input.insert(input.end(), chunk, chunk + n);
+            long long completed = 0;
+            while (input.size() - consumed >= sizeof(uint32_t)) {
+                uint32_t frameLength;
+                memcpy(&frameLength, input.data() + consumed, sizeof(frameLength));
+                if (input.size() - consumed - sizeof(uint32_t) < frameLength) break;
+                SnapshotReader in(input.data() + consumed + sizeof(uint32_t), frameLength);
+                uint8_t opcode = in.get<uint8_t>();
+                uint32_t requestId = in.get<uint32_t>();
+                if (opcode != PUSH_TICK) {
+                    auto elapsed = chrono::steady_clock::now() - sentAt[requestId % depth];
+                    latencyMetrics().record(Metric::Request, chrono::duration_cast<chrono::nanoseconds>(elapsed).count());
+                    if (in.get<uint8_t>() != 0) failures++;
+                    received++;
+                    completed++;
+                }
+                consumed += sizeof(uint32_t) + frameLength;
+            }
+            input.erase(input.begin(), input.begin() + consumed);
+            consumed = 0;
+            if (completed > 0) ok = queue(completed);
+        }
+        failures += sent - received + (requests - sent);
+        close(fd);
+    }
+
+public:
+    static void run(const string& address, int clients, long long requestsPerClient, int depth) {
+        depth = max(depth, 1);
+        latencyMetrics().reset();
+        atomic<long long> failures(0);
+        auto start = chrono::steady_clock::now();
+        vector<thread> threads;
+        for (int c = 0; c < clients; ++c) {
+            threads.emplace_back(client, address, requestsPerClient, depth, ref(failures));
+        }
+        for (thread& t : threads) t.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        LatencyMetrics::Summary summary = latencyMetrics().summarize(Metric::Request);
+        cout << "Load test: " << clients << " clients x " << requestsPerClient << " requests, depth " << depth << "\n";
+        cout << summary.count << " responses (" << failures.load() << " failed) in " << fixed << setprecision(3)
+             << seconds << " s: " << setprecision(0) << summary.count / seconds << " requests/s\n";
+        cout << setprecision(1) << "Latency us: p50 " << summary.p50 / 1000 << ", p99 " << summary.p99 / 1000
+             << ", p999 " << summary.p999 / 1000 << ", max " << summary.max / 1000 << "\n";
+    }
+};
+#endif
+
+// Benchmark Suite
+// Stonks --bench [--max N] [--save FILE] [--compare FILE] [--threshold PCT]
+// times each core data structure on synthetic universes of 10, 100, ... up to
+// N symbols (default 1M; 10M needs several GB) and prints ns/op, allocations
+// per op (with -DSTONKS_COUNT_ALLOCATIONS) and ns/op relative to the smallest
+// universe, which is the scaling curve. --save writes the results as CSV
+// (benchmark,symbols,ops,ns_per_op,allocs_per_op); --compare reads such a
+// file and fails when any ns/op grew by more than the threshold (default 25%).
+class BenchmarkSuite {
+public:
+    struct Result {
+        string name;
+        size_t symbols;
+        long long ops;
+        double nsPerOp;
+        double allocsPerOp;  // negative when allocation counting is off
+    };
+
+private:
+    // Swallows debug output (builds with STONKS_LOG_LEVEL >= 2)
+    class NullBuffer : public streambuf {
+    protected:
+        int overflow(int c) override { return c; }
+    };
+
+    vector<Result> results;
+    size_t maxSymbols;
+    volatile long long sink;  // keeps measured reads from being optimized away
+
+    template <typename Body>
+    void measure(const string& name, size_t symbols, long long ops, Body body) {
+        NullBuffer discard;
+        streambuf* previous = cout.rdbuf(&discard);
+        long long allocationsBefore = allocationCount();
+        auto start = chrono::steady_clock::now();
+        try {
+            body();
+        } catch (...) {
+            cout.rdbuf(previous);
+            throw;
+        }
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        long long allocationsAfter = allocationCount();
+        cout.rdbuf(previous);
+
+        double allocsPerOp = allocationsBefore < 0 ? -1.0 : (double)(allocationsAfter - allocationsBefore) / ops;
+        results.push_back(Result{name, symbols, ops, ns / ops, allocsPerOp});
+        printResult(results.back());
+    }
+
+    void printResult(const Result& result) const {
+        double smallest = result.nsPerOp;
+        for (const Result& other : results) {
+            if (other.name == result.name) {
+                smallest = other.nsPerOp;
+                break;
+            }
+        }
+        cout << left << setw(22) << result.name << right << setw(10) << result.symbols << setw(12) << result.ops
+             << fixed << setprecision(1) << setw(12) << result.nsPerOp;
+        if (result.allocsPerOp < 0) {
+            cout << setw(12) << "n/a";
+        } else {
+            cout << setprecision(3) << setw(12) << result.allocsPerOp;
+        }
+        cout << setprecision(2) << setw(10) << result.nsPerOp / smallest << "x\n" << flush;
+    }
+
+    // Operations per measurement: about `budget` units of work, at least `minimum`
+    static long long opsFor(size_t symbols, long long budget, long long minimum) {
+        return max<long long>(minimum, budget / (long long)symbols);
+    }
+
+    void benchMarket(size_t n) {
+        StockMarket market;
+        market.configureHistory(64, PriceHistory::DEFAULT_WINDOW, "", true);
+        market.generateUniverse((int)n);
+        size_t listed = market.size();
+
+        long long rounds = opsFor(n, 2000000, 1);
+        measure("stock.updatePrice", n, rounds * listed, [&] {
+            for (long long r = 0; r < rounds; ++r) {
+                for (size_t i = 0; i < listed; ++i) market.getStockAt(i).updatePrice();
+            }
+        });
+
+        long long ticks = opsFor(n, 2000000, 3);
+        measure("market.updateMarket", n, ticks, [&] {
+            for (long long t = 0; t < ticks; ++t) market.updateMarket();
+        });
+
+        // Picked up front so small universes never run out of shares to buy
+        vector<Stock*> picks;
+        vector<int> remaining(listed);
+        for (size_t i = 0; i < listed; ++i) remaining[i] = market.getStockAt(i).getAvailableShares();
+        uint32_t state = 1;
+        for (int attempt = 0; attempt < 400000 && picks.size() < 200000; ++attempt) {
+            size_t index = mixBits(state += 0x9E3779B9U) % listed;
+            if (remaining[index]-- > 0) picks.push_back(&market.getStockAt(index));
+        }
+        const long long trades = picks.size();
+
+        Portfolio portfolio(1e15);
+        measure("portfolio.buyStock", n, trades, [&] {
+            for (Stock* stock : picks) portfolio.buyStock(*stock, 1);
+        });
+        measure("portfolio.holdings", n, trades, [&] {
+            uint32_t state = 2;
+            long long held = 0;
+            for (long long i = 0; i < trades; ++i) {
+                held += portfolio.holdings(market.getStockAt(mixBits(state += 0x9E3779B9U) % listed).getId());
+            }
+            sink = held;
+        });
+        measure("portfolio.sellStock", n, trades, [&] {
+            for (Stock* stock : picks) portfolio.sellStock(*stock, 1);
+        });
+    }
+
+    // Small universes are repeated over separate heaps/graphs so every measurement has enough ops
+    void benchHeap(size_t n) {
+        vector<MaxHeap> heaps(opsFor(n, 1000000, 1));
+        measure("heap.insert", n, heaps.size() * n, [&] {
+            for (MaxHeap& heap : heaps) {
+                for (size_t i = 0; i < n; ++i) heap.update((SymbolId)i, (double)mixBits((uint32_t)i));
+            }
+        });
+        measure("heap.removeMax", n, heaps.size() * n, [&] {
+            for (MaxHeap& heap : heaps) {
+                for (size_t i = 0; i < n; ++i) heap.removeMax();
+            }
+        });
+    }
+
+    void benchGraph(size_t n) {
+        long long edges = min<long long>(4LL * n, 4000000);
+        vector<Graph> graphs(opsFor(edges, 400000, 1));
+        measure("graph.addEdge", n, graphs.size() * edges, [&] {
+            for (Graph& graph : graphs) {
+                uint32_t state = 3;
+                for (long long e = 0; e < edges; ++e) {
+                    uint32_t a = mixBits(state += 0x9E3779B9U);
+                    graph.addEdge(a % n, mixBits(a) % n);
+                }
+            }
+        });
+    }
+
+    // Queries are ticker-like: the symbol of a random listing, truncated for
+    // prefixes and with one digit changed for fuzzy matches
+    void benchSearch(size_t n) {
+        StockMarket market;
+        market.generateUniverse((int)n);
+        market.getSearchIndex();
+        const long long queries = 2000;
+        vector<string> symbols(queries);
+        uint32_t state = 4;
+        for (string& symbol : symbols) {
+            symbol = market.getStockAt(mixBits(state += 0x9E3779B9U) % market.size()).getSymbol();
+        }
+        measure("search.prefix", n, queries, [&] {
+            size_t found = 0;
+            for (const string& symbol : symbols) {
+                found += market.searchPrefix(symbol.substr(0, symbol.size() - 2), 10, RankKey::Price, true).size();
+            }
+            sink = found;
+        });
+        for (string& symbol : symbols) symbol.back() = symbol.back() == '9' ? '0' : symbol.back() + 1;
+        measure("search.fuzzy", n, queries, [&] {
+            size_t found = 0;
+            for (const string& symbol : symbols) found += market.searchFuzzy(symbol, 5, 1, RankKey::Price).size();
+            sink = found;
+        });
+    }
+
+public:
+    BenchmarkSuite(size_t maximum) : maxSymbols(maximum) {}
+
+    const vector<Result>& run() {
+        cout << left << setw(22) << "Benchmark" << right << setw(10) << "Symbols" << setw(12) << "Ops"
+             << setw(12) << "ns/op" << setw(12) << "allocs/op" << setw(11) << "scaling" << "\n";
+        for (size_t n = 10; n <= maxSymbols; n *= 10) benchMarket(n);
+        for (size_t n = 10; n <= maxSymbols; n *= 10) benchHeap(n);
+        for (size_t n = 10; n <= maxSymbols; n *= 10) benchGraph(n);
+        for (size_t n = 10; n <= maxSymbols; n *= 10) benchSearch(n);
+        return results;
+    }
+
+    void save(const string& path) const {
+        ofstream out(path);
+        if (!out) throw runtime_error("Cannot write baseline: " + path);
+        out << "benchmark,symbols,ops,ns_per_op,allocs_per_op\n";
+        for (const Result& result : results) {
+            out << result.name << "," << result.symbols << "," << result.ops << "," << fixed << setprecision(3)
+                << result.nsPerOp << "," << result.allocsPerOp << "\n";
+        }
+    }
+
+    // Prints each result against the baseline; returns the number of regressions
+    int compare(const string& path, double thresholdPercent) const {
+        ifstream in(path);
+        if (!in) throw runtime_error("Cannot read baseline: " + path);
+        map<pair<string, size_t>, double> baseline;
+        string line;
+        getline(in, line);  // header
+        while (getline(in, line)) {
+            stringstream fields(line);
+            string name, symbols, ops, ns;
+            if (getline(fields, name, ',') && getline(fields, symbols, ',') && getline(fields, ops, ',') &&
+                getline(fields, ns, ',')) {
+                size_t count = parseNumber(symbols, [](const string& text, size_t* used) { return stoull(text, used); });
+                baseline[{name, count}] = parseNumber(ns, [](const string& text, size_t* used) { return stod(text, used); });
+            } else if (!line.empty()) {
+                throw runtime_error("Malformed baseline line: " + line);
+            }
+        }
+
+        cout << "\n=== Against baseline " << path << " (threshold " << thresholdPercent << "%) ===\n";
+        int regressions = 0;
+        for (const Result& result : results) {
+            auto it = baseline.find({result.name, result.symbols});
+            if (it == baseline.end()) continue;
+            double change = (result.nsPerOp / it->second - 1.0) * 100.0;
+            bool regressed = change > thresholdPercent;
+            regressions += regressed;
+            cout << left << setw(22) << result.name << right << setw(10) << result.symbols << fixed << setprecision(1)
+                 << setw(12) << it->second << setw(12) << result.nsPerOp << setw(9) << showpos << change << "%"
+                 << noshowpos << (regressed ? "  REGRESSION" : "") << "\n";
+        }
+        cout << left << regressions << " regression(s)\n";
+        return regressions;
+    }
+};
+
+// Main Function
+int main(int argc, char* argv[]) {
+    StockMarket market;
+    PortfolioManager portfolioManager;
     string choice;
 
+    // Fast restart: Stonks --restore snapshot [--batch ...]
+    int firstArg = 1;
+    if (argc > 2 && string(argv[1]) == "--restore") {
+        try {
+            SnapshotStore().load(argv[2], market, portfolioManager);
+        } catch (const runtime_error& e) {
+            cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        firstArg = 3;
+    }
+
+    // Benchmarks: Stonks --bench [--max N] [--save FILE] [--compare FILE] [--threshold PCT]
+    if (argc > 1 && string(argv[1]) == "--bench") {
+        size_t maxSymbols = 1000000;
+        string savePath, comparePath;
+        double threshold = 25.0;
+        try {
+            for (int i = 2; i < argc; i += 2) {
+                string option = argv[i];
+                if (i + 1 >= argc) throw runtime_error("Missing value for " + option);
+                string value = argv[i + 1];
+                if (option == "--max") {
+                    maxSymbols = parseNumber(value, [](const string& text, size_t* used) -> size_t {
+                        if (text.find('-') != string::npos) throw invalid_argument(text);
+                        return stoull(text, used);
+                    });
+                } else if (option == "--save") {
+                    savePath = value;
+                } else if (option == "--compare") {
+                    comparePath = value;
+                } else if (option == "--threshold") {
+                    threshold = parseNumber(value, [](const string& text, size_t* used) { return stod(text, used); });
+                } else {
+                    throw runtime_error("Unknown --bench option " + option);
+                }
+            }
+            BenchmarkSuite suite(maxSymbols);
+            suite.run();
+            if (!savePath.empty()) suite.save(savePath);
+            if (!comparePath.empty() && suite.compare(comparePath, threshold) > 0) return 1;
+        } catch (const runtime_error& e) {
+            cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    // Server mode: Stonks [--restore FILE] --serve unix:PATH|tcp:PORT [--tick MS]
+    // Load test:   Stonks --loadtest unix:PATH|tcp:PORT CLIENTS REQUESTS [DEPTH]
+    if (argc > firstArg && (string(argv[firstArg]) == "--serve" || string(argv[firstArg]) == "--loadtest")) {
+#ifdef __linux__
+        try {
+            if (string(argv[firstArg]) == "--loadtest") {
+                if (argc < firstArg + 4) {
+                    cerr << "Usage: Stonks --loadtest ADDRESS CLIENTS REQUESTS [DEPTH]\n";
+                    return 1;
+                }
+                LoadTest::run(argv[firstArg + 1], stoi(argv[firstArg + 2]), stoll(argv[firstArg + 3]),
+                              argc > firstArg + 4 ? stoi(argv[firstArg + 4]) : 1);
+                return 0;
+            }
+            if (argc < firstArg + 2) {
+                cerr << "Usage: Stonks --serve ADDRESS [--tick MS]\n";
+                return 1;
+            }
+            int tickMillis = 1000;
+            if (argc > firstArg + 3 && string(argv[firstArg + 2]) == "--tick") tickMillis = stoi(argv[firstArg + 3]);
+            MarketServer server(market, portfolioManager);
+            server.listen(argv[firstArg + 1]);
+            server.run(tickMillis);
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+#else
+        cerr << "Server mode needs Linux (epoll)\n";
+        return 1;
+#endif
+    }
+
+    // Headless mode: Stonks --batch [script]  (reads stdin when no script is given)
+    if (argc > firstArg && string(argv[firstArg]) == "--batch") {
+        ios::sync_with_stdio(false);
+        cin.tie(nullptr);
+        static char outputBuffer[1 << 16];
+        cout.rdbuf()->pubsetbuf(outputBuffer, sizeof(outputBuffer));
+
+        BatchRunner runner(market, portfolioManager);
+        if (argc > firstArg + 1) {
+            ifstream script(argv[firstArg + 1]);
+            if (!script) {
+                cerr << "Cannot open script: " << argv[firstArg + 1] << "\n";
+                return 1;
+            }
+            runner.run(script);
+        } else {
+            runner.run(cin);
+        }
+        return 0;
+    }
+
     cout << "Welcome to Stock Market Simulator!\n";
 
     do {
@@ -538,7 +6445,7 @@ int main() {
 
                 try {
                     Stock& stock = market.getStock(symbol);
-                    portfolioManager.getCurrentPortfolio().buyStock(stock, shares);
+                    portfolioManager.buyStock(stock, shares);
                     cout << "Stock purchased successfully.\n";
                 } catch (const runtime_error& e) {
                     cout << "Error: " << e.what() << "\n";
@@ -558,7 +6465,7 @@ int main() {
 
                 try {
                     Stock& stock = market.getStock(symbol);
-                    portfolioManager.getCurrentPortfolio().sellStock(stock, shares);
+                    portfolioManager.sellStock(stock, shares);
                     cout << "Stock sold successfully.\n";
                 } catch (const runtime_error& e) {
                     cout << "Error: " << e.what() << "\n";
@@ -595,6 +6502,7 @@ int main() {
                 }
             } else if (choice == "10") {
                 market.updateMarket();
+                portfolioManager.revalue(market);
                 cout << "Market updated!\n";
             } else if (choice == "11") {
                 int N;
@@ -0,0 +1,18 @@
+#!/bin/sh
+# Runs every tests/batch/*.batch script through `Stonks --batch` and compares
+# its output (minus the timing summary line) with the matching .expected file.
+# Usage: tests/run_batch_tests.sh path/to/Stonks
+binary=${1:?usage: $0 path/to/Stonks}
+dir=$(dirname "$0")/batch
+failed=0
+for script in "$dir"/*.batch; do
+    expected=${script%.batch}.expected
+    if "$binary" --batch < "$script" 2>/dev/null | grep -v '^Batch: ' | diff -u "$expected" - > /dev/null; then
+        echo "PASS $(basename "$script")"
+    else
+        echo "FAIL $(basename "$script")"
+        "$binary" --batch < "$script" 2>/dev/null | grep -v '^Batch: ' | diff -u "$expected" -
+        failed=1
+    fi
+done
+exit $failed